@@ -7,6 +7,9 @@
 #include <random>
 #include <chrono>
 #include <sstream>
+#include <memory>
+#include "wave_kernels.h"
+#include "journal.h"
 
 class WaveGrub {
 private:
@@ -37,7 +40,10 @@ public:
     }
 
     void generate_target_wave() {
-        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+        generate_target_wave(std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    void generate_target_wave(unsigned seed) {
         std::default_random_engine generator(seed);
         std::uniform_real_distribution<double> dist(0.5, 1.5);
         
@@ -45,15 +51,11 @@ public:
         target_freq = dist(generator);
         target_phase = dist(generator) * M_PI;
 
-        for (int i = 0; i < SIZE; ++i) {
-            target_wave[i] = target_amp * std::sin(target_freq * t[i] + target_phase);
-        }
+        sine_wave(target_wave.data(), t.data(), SIZE, target_amp, target_freq, target_phase);
     }
 
     void update_wave() {
-        for (int i = 0; i < SIZE; ++i) {
-            wave[i] = amp * std::sin(freq * t[i] + phase);
-        }
+        sine_wave(wave.data(), t.data(), SIZE, amp, freq, phase);
     }
 
     void interpret(const std::string& code) {
@@ -79,12 +81,16 @@ public:
         phase = 0;
     }
 
+    // Both buffers are always plain sinusoids here, so the error comes
+    // straight from the parameters.
     double calculate_error() {
-        double error = 0;
-        for (int i = 0; i < SIZE; ++i) {
-            error += std::pow(wave[i] - target_wave[i], 2);
-        }
-        return std::sqrt(error / SIZE);
+        return analytic_rms_error(SIZE, amp, freq, phase, target_amp, target_freq, target_phase);
+    }
+
+    // Hash of both waves and their parameters, which a replayed game checks
+    uint64_t checksum() const {
+        const double params[6] = {amp, freq, phase, target_amp, target_freq, target_phase};
+        return state_hash(target_wave.data(), SIZE, state_hash(wave.data(), SIZE, state_hash(params, 6)));
     }
 
     void print_waves() {
@@ -112,9 +118,61 @@ public:
     }
 };
 
-int main() {
+// Runs a journal recorded with --record at full speed with std::cout
+// discarded, checking both waves after every line
+int replay(WaveGrub& wg, const std::string& path) {
+    std::unique_ptr<JournalReader> journal;
+    try {
+        journal.reset(new JournalReader(path, "b"));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    ReplayStats stats;
+    {
+        SilencedStream quiet(std::cout);
+        std::string line;
+        JournalRecord r;
+        auto start = std::chrono::steady_clock::now();
+        while (journal->next(r)) {
+            switch (r.kind) {
+                case 'S': wg.generate_target_wave((unsigned)r.u64()); break;
+                case 'L':
+                    line.assign(r.data, r.size);
+                    wg.interpret(line);
+                    ++stats.lines;
+                    break;
+                case 'H': stats.check(r.u64(), wg.checksum()); break;
+            }
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return stats.report(std::cout, path, journal->truncated());
+}
+
+int main(int argc, char* argv[]) {
     WaveGrub wg;
     std::string input;
+    std::string record_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--replay=") == 0) return replay(wg, arg.substr(9));
+        if (arg.compare(0, 9, "--record=") == 0) record_path = arg.substr(9);
+    }
+
+    // The target's seed is recorded so replay starts from the same target
+    std::unique_ptr<JournalWriter> journal;
+    if (!record_path.empty()) {
+        try {
+            journal.reset(new JournalWriter(record_path, "b"));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+        wg.generate_target_wave(seed);
+        journal->u64('S', seed);
+    }
 
     std::cout << "Welcome to a, the Wave Matching Game!" << std::endl;
     std::cout << "Try to match the target wave by adjusting the parameters." << std::endl;
@@ -129,13 +187,16 @@ int main() {
 
     while (true) {
         std::cout << "> ";
-        std::getline(std::cin, input);
-        
-        if (input == "quit") {
+        if (!std::getline(std::cin, input) || input == "quit") {
             break;
         }
 
         wg.interpret(input);
+        if (journal) {
+            journal->text('L', input);
+            journal->u64('H', wg.checksum());
+            journal->flush();
+        }
         wg.print_waves();
         wg.print_solution_memory();
 
@@ -146,5 +207,9 @@ int main() {
     }
 
     std::cout << "Thank you for playing the Wave Matching Game!" << std::endl;
+    if (journal && !journal->ok()) {
+        std::cerr << "Cannot write " << record_path << std::endl;
+        return 1;
+    }
     return 0;
 }
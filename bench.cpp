@@ -0,0 +1,351 @@
+// Benchmarks for the c+++ interpreter (c.cpp) and the wave matching game
+// (for_uci.cpp). Both programs are compiled into this binary, each in its
+// own namespace with its main() left out, and every benchmark prints one
+// record with ns/sample, samples/sec and heap allocations per iteration.
+//
+//   ./bench [--format=json|csv] [--size=N] [--min-time=SECONDS]
+//           [--filter=TEXT] [--slow]
+//
+// "samples" is the number of wave samples one iteration touches, so the
+// per-sample numbers compare across wave sizes. --slow adds the original
+// serial auto_solve sweep, which takes minutes.
+
+// The namespaced programs below include these too; pulling them in at file
+// scope first keeps their contents out of the namespaces.
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <unordered_map>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <cstdint>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <fstream>
+#include <map>
+#include <atomic>
+#include <limits>
+#include <complex>
+#include <new>
+#include <condition_variable>
+#include <cerrno>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "wave_kernels.h"
+#include "thread_pool.h"
+#include "telemetry.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "block_writer.h"
+#include "wave_file.h"
+#include "journal.h"
+
+#define WAVEGRUB_NO_MAIN
+namespace cppp {
+#include "c.cpp"
+}
+namespace game {
+#include "for_uci.cpp"
+}
+using cppp::FixedProgram;
+
+static std::atomic<size_t> allocations(0);
+static volatile double sink;
+
+// Out of line so GCC doesn't pair an inlined free() with operator new and
+// warn about a mismatch.
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+
+struct BenchResult {
+    std::string name;
+    double samples;
+    long iterations;
+    double ns_per_iteration;
+    double allocations_per_iteration;
+};
+
+struct BenchOptions {
+    int samples = 256;
+    double min_time = 0.2;
+    std::string filter;
+    bool slow = false;
+    bool csv = false;
+};
+
+class Bench {
+private:
+    BenchOptions options;
+    std::vector<BenchResult> results;
+
+public:
+    explicit Bench(const BenchOptions& o) : options(o) {}
+
+    // Times body() with the iteration count doubled until one pass takes
+    // at least --min-time; setup() runs untimed before each pass.
+    template <class Setup, class Body>
+    void run(const std::string& name, double samples, Setup setup, Body body) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+        setup();
+        body();
+        long iterations = 1;
+        while (true) {
+            setup();
+            size_t allocs = allocations.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < iterations; ++i) body();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            allocs = allocations.load(std::memory_order_relaxed) - allocs;
+            if (ns >= options.min_time * 1e9 || iterations >= (1L << 30)) {
+                results.push_back({name, samples, iterations, ns / iterations, (double)allocs / iterations});
+                std::cerr << name << ": " << ns / iterations << " ns" << std::endl;
+                return;
+            }
+            iterations *= 2;
+        }
+    }
+
+    template <class Body>
+    void run(const std::string& name, double samples, Body body) {
+        run(name, samples, [] {}, body);
+    }
+
+    void write(std::ostream& os) const {
+        os << std::setprecision(6);
+        if (options.csv) {
+            os << "name,samples,iterations,ns_per_iteration,ns_per_sample,samples_per_sec,allocations_per_iteration\n";
+            for (const BenchResult& r : results) {
+                os << r.name << ',' << r.samples << ',' << r.iterations << ',' << r.ns_per_iteration << ','
+                   << r.ns_per_iteration / r.samples << ',' << r.samples * 1e9 / r.ns_per_iteration << ','
+                   << r.allocations_per_iteration << '\n';
+            }
+            return;
+        }
+        os << "{\n  \"size\": " << options.samples << ",\n  \"sine_isa\": \"" << sine_isa_name(sine_isa())
+           << "\",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            os << "    {\"name\": \"" << r.name << "\", \"samples\": " << r.samples
+               << ", \"iterations\": " << r.iterations << ", \"ns_per_iteration\": " << r.ns_per_iteration
+               << ", \"ns_per_sample\": " << r.ns_per_iteration / r.samples
+               << ", \"samples_per_sec\": " << r.samples * 1e9 / r.ns_per_iteration
+               << ", \"allocations_per_iteration\": " << r.allocations_per_iteration << "}"
+               << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        os << "  ]\n}\n";
+    }
+};
+
+// A fixed pseudo-random c+++ script of the given length, split into REPL
+// lines of up to 16 commands.
+std::vector<std::string> make_script(size_t commands) {
+    static const char alphabet[] = "AaFfPpRN=*+-/I";
+    std::mt19937 generator(12345);
+    std::uniform_int_distribution<int> pick(0, sizeof(alphabet) - 2);
+    std::uniform_int_distribution<int> length(1, 16);
+    std::vector<std::string> lines;
+    while (commands > 0) {
+        size_t k = std::min<size_t>(commands, length(generator));
+        std::string line;
+        for (size_t i = 0; i < k; ++i) line += alphabet[pick(generator)];
+        lines.push_back(line);
+        commands -= k;
+    }
+    return lines;
+}
+
+template <class Grub>
+void bench_interpreter(Bench& bench, int samples) {
+    NullBuffer null_buffer;  // journal.h's: printing still pays for formatting
+    std::ostream null(&null_buffer);
+    Grub wg(samples);
+    wg.set_output(null);
+    wg.seed(1);
+    const double n = wg.size();
+
+    bench.run("c/update_wave", n, [&] { wg.update_wave(); });
+    // Buffer ops run in inverse pairs so repeated passes don't drift the
+    // samples into denormals
+    bench.run("c/inverse_wave", 2 * n, [&] { wg.update_wave(); }, [&] { wg.inverse_wave(); wg.inverse_wave(); });
+    bench.run("c/print_waves", n, [&] { wg.print_waves(); });
+
+    static const char* const single[] = {"A", "a", "F", "f", "P", "p", "R", "N", "="};
+    for (const char* op : single) {
+        bench.run(std::string("c/interpret/") + op, n, [&] { wg.reset_wave(); }, [&] { wg.interpret(op); });
+    }
+    static const char* const pairs[][3] = {{"*", "/", "mul+div"}, {"+", "-", "add+sub"}, {"I", "I", "inverse+inverse"}};
+    for (const auto& pair : pairs) {
+        const std::string first = pair[0], second = pair[1];
+        bench.run(std::string("c/interpret/") + pair[2], 2 * n, [&] { wg.reset_wave(); wg.update_wave(); },
+                  [&] { wg.interpret(first); wg.interpret(second); });
+    }
+
+    // Registers: storing and loading share the buffer, and the op then
+    // copies it (w / w settles at 1, so repeats stay out of denormals)
+    bench.run("c/interpret/store+load", n, [&] { wg.interpret(">1<1"); });
+    bench.run("c/interpret/store+div_register", n, [&] { wg.reset_wave(); wg.update_wave(); },
+              [&] { wg.interpret(">1/1"); });
+
+    // Startup: a new interpreter running a short known program
+    bench.run("c/startup/interpret", n, [&] {
+        Grub fresh(samples);
+        fresh.set_output(null);
+        fresh.interpret("AAF*PP");
+    });
+    bench.run("c/startup/fixed", n, [&] {
+        Grub fresh(samples);
+        fresh.set_output(null);
+        fresh.run(CPPP_FIXED("AAF*PP"));
+    });
+
+    // One generated program of a million commands per dispatch engine
+    std::string program;
+    for (const std::string& line : make_script(1000000)) program += line;
+    for (cppp::Dispatch d : {cppp::Dispatch::Switch, cppp::Dispatch::Threaded}) {
+        wg.set_dispatch(d);
+        bench.run(std::string("c/program_1m/") + cppp::dispatch_name(d), 1e6 * n,
+                  [&] { wg.reset_wave(); wg.seed(1); }, [&] { wg.interpret(program); });
+    }
+    wg.set_dispatch(cppp::Dispatch::Threaded);
+
+    // Streaming blocks, steady and with every block ramping to new
+    // parameters over its first 256 samples
+    std::vector<float> block(1024);
+    const cppp::WaveParams low = {1, 1, 0}, high = {1.5, 2, 1};
+    cppp::WaveStream steady(1024, 48000, 48000.0 / n, 0, low);
+    bench.run("c/stream/block", 1024, [&] { steady.render(block.data(), low); });
+    cppp::WaveStream ramped(1024, 48000, 48000.0 / n, 256, low);
+    bool flip = false;
+    bench.run("c/stream/ramp", 1024, [&] {
+        flip = !flip;
+        ramped.render(block.data(), flip ? high : low);
+    });
+
+    // Dumping a wave per '=' to a wave file, through the writer's buffer
+    {
+        WaveFileWriter dump("/dev/null", WaveDType::Float64, n, 0, false);
+        bench.run("c/dump/append", n, [&] { dump.append(wg.samples(), WaveFileParams{1, 1, 0}); });
+    }
+
+    // A thousand waves as one WaveBank and as separate WaveGrubs
+    const int waves = 1000;
+    cppp::WaveBank bank(waves, samples);
+    bank.set_output(null);
+    std::vector<std::unique_ptr<Grub>> grubs;
+    for (int i = 0; i < waves; ++i) {
+        grubs.emplace_back(new Grub(samples));
+        grubs.back()->set_output(null);
+        grubs.back()->set_wave_cache_budget(0);
+    }
+    static const char* const bank_programs[][2] = {{"AaFf", "params"}, {"*/", "mul+div"}};
+    for (const auto& program : bank_programs) {
+        const std::string code = program[0];
+        bench.run(std::string("c/bank_1k/") + program[1], waves * n, [&] { bank.interpret(code); });
+        bench.run(std::string("c/grubs_1k/") + program[1], waves * n, [&] {
+            for (auto& g : grubs) g->interpret(code);
+        });
+    }
+
+    const std::vector<std::string> script = make_script(10000);
+    bench.run("c/script_10k", 10000 * n, [&] {
+        Grub fresh(samples);
+        fresh.set_output(null);
+        fresh.seed(1);
+        for (const std::string& line : script) fresh.interpret(line);
+    });
+}
+
+template <class Grub>
+void bench_game(Bench& bench, int samples, bool slow) {
+    Grub wg(samples);
+    wg.generate_target_wave(1);
+    const double n = wg.size();
+
+    bench.run("game/update_wave", n, [&] { wg.update_wave(); });
+    bench.run("game/calculate_error", n, [&] { sink = wg.calculate_error(); });
+    bench.run("game/sampled_error", n, [&] { sink = wg.sampled_error(); });
+    double value = M_PI;
+    bench.run("game/to_hex", 1, [&] { sink = wg.to_hex(value).size(); });
+
+    // The solvers log to std::cout
+    NullBuffer null_buffer;
+    std::streambuf* saved = std::cout.rdbuf(&null_buffer);
+    bench.run("game/print_waves", n, [&] { wg.print_waves(); });
+
+    struct Solver {
+        const char* name;
+        game::SolverMode mode;
+    };
+    static const Solver solvers[] = {
+        {"game/auto_solve/parallel", game::SolverMode::Parallel},
+        {"game/auto_solve/lsq", game::SolverMode::LeastSquares},
+        {"game/auto_solve/lm", game::SolverMode::LevenbergMarquardt},
+        {"game/auto_solve/serial", game::SolverMode::Serial},
+    };
+    for (const Solver& s : solvers) {
+        if (s.mode == game::SolverMode::Serial && !slow) continue;
+        wg.set_solver(s.mode, 0, 16);
+        bench.run(s.name, n, [&] { wg.reset_wave(); wg.update_wave(); }, [&] { wg.auto_solve(); });
+    }
+    std::cout.rdbuf(saved);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--format=json") options.csv = false;
+        else if (arg == "--format=csv") options.csv = true;
+        else if (arg == "--slow") options.slow = true;
+        else if (arg.compare(0, 7, "--size=") == 0) options.samples = std::atoi(arg.c_str() + 7);
+        else if (arg.compare(0, 11, "--min-time=") == 0) options.min_time = std::atof(arg.c_str() + 11);
+        else if (arg.compare(0, 9, "--filter=") == 0) options.filter = arg.substr(9);
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (options.samples < 1) {
+        std::cerr << "Wave size must be positive" << std::endl;
+        return 1;
+    }
+
+    Bench bench(options);
+    if (options.samples == 256) {
+        bench_interpreter<cppp::WaveGrub<256>>(bench, options.samples);
+        bench_game<game::WaveGrub<256>>(bench, options.samples, options.slow);
+    } else {
+        bench_interpreter<cppp::WaveGrub<0>>(bench, options.samples);
+        bench_game<game::WaveGrub<0>>(bench, options.samples, options.slow);
+    }
+    bench.write(std::cout);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#ifndef BLOCK_WRITER_H
+#define BLOCK_WRITER_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams fixed-size blocks of float samples to a file descriptor. There
+// are two blocks: the producer fills one while a writer thread write()s
+// the other straight from its buffer, so a slow consumer only stalls the
+// producer once both are full. Both buffers are allocated up front.
+//
+// Wav output is mono IEEE float. The size fields start out as 0xFFFFFFFF,
+// as for a stream of unknown length, and close() fills them in when the
+// output can seek.
+class BlockWriter {
+public:
+    enum Format { Raw, Wav };
+
+private:
+    int fd;
+    bool owns_fd;
+    Format format;
+    size_t block;
+    std::vector<float> buffers[2];
+    bool full[2];
+    int fill_index;
+    bool closing, failed;
+    uint64_t bytes_written;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread writer;
+
+    bool write_all(const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t k = ::write(fd, p, size);
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return false;
+            p += k;
+            size -= (size_t)k;
+        }
+        return true;
+    }
+
+    static void put_u32(char* p, uint32_t v) {
+        for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (8 * i));
+    }
+
+    static void put_u16(char* p, uint16_t v) {
+        p[0] = (char)v;
+        p[1] = (char)(v >> 8);
+    }
+
+    void write_wav_header(uint32_t rate) {
+        char h[44];
+        std::memcpy(h, "RIFF", 4);
+        put_u32(h + 4, 0xFFFFFFFFu);
+        std::memcpy(h + 8, "WAVEfmt ", 8);
+        put_u32(h + 16, 16);
+        put_u16(h + 20, 3);  // IEEE float
+        put_u16(h + 22, 1);  // mono
+        put_u32(h + 24, rate);
+        put_u32(h + 28, rate * (uint32_t)sizeof(float));
+        put_u16(h + 32, sizeof(float));
+        put_u16(h + 34, 8 * sizeof(float));
+        std::memcpy(h + 36, "data", 4);
+        put_u32(h + 40, 0xFFFFFFFFu);
+        if (!write_all(h, sizeof(h))) throw std::runtime_error("cannot write wav header");
+    }
+
+    void loop() {
+        int write_index = 0;
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            changed.wait(guard, [&] { return full[write_index] || closing; });
+            if (!full[write_index]) return;
+            guard.unlock();
+            bool ok = write_all(buffers[write_index].data(), block * sizeof(float));
+            guard.lock();
+            if (ok) bytes_written += block * sizeof(float);
+            else failed = true;
+            full[write_index] = false;
+            write_index ^= 1;
+            changed.notify_all();
+        }
+    }
+
+public:
+    // path "-" writes to stdout. rate is only used for the wav header.
+    BlockWriter(const std::string& path, Format f, size_t block_samples, uint32_t rate) :
+        fd(1), owns_fd(false), format(f), block(block_samples), fill_index(0),
+        closing(false), failed(false), bytes_written(0) {
+        if (path != "-") {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) throw std::runtime_error("cannot open " + path);
+            owns_fd = true;
+        }
+        if (format == Wav) write_wav_header(rate);
+        for (int i = 0; i < 2; ++i) {
+            buffers[i].assign(block, 0.0f);
+            full[i] = false;
+        }
+        writer = std::thread(&BlockWriter::loop, this);
+    }
+
+    ~BlockWriter() { close(); }
+
+    BlockWriter(const BlockWriter&) = delete;
+    BlockWriter& operator=(const BlockWriter&) = delete;
+
+    // The block to fill next, once the writer is done with it
+    float* acquire() {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&] { return !full[fill_index]; });
+        return buffers[fill_index].data();
+    }
+
+    // Queues the block returned by acquire(). Returns false once a write
+    // has failed, say because the reader closed the pipe.
+    bool submit() {
+        std::lock_guard<std::mutex> guard(lock);
+        full[fill_index] = true;
+        fill_index ^= 1;
+        changed.notify_all();
+        return !failed;
+    }
+
+    // Writes what is queued, patches the wav sizes if it can, and closes.
+    void close() {
+        if (!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closing = true;
+        }
+        changed.notify_all();
+        writer.join();
+        if (format == Wav && ::lseek(fd, 0, SEEK_CUR) >= 0 && bytes_written + 36 <= 0xFFFFFFFFu) {
+            char size[4];
+            put_u32(size, (uint32_t)(bytes_written + 36));
+            bool ok = ::pwrite(fd, size, 4, 4) == 4;
+            put_u32(size, (uint32_t)bytes_written);
+            if (!ok || ::pwrite(fd, size, 4, 40) != 4) failed = true;
+        }
+        if (owns_fd) ::close(fd);
+    }
+
+    size_t block_size() const { return block; }
+    uint64_t bytes() const { return bytes_written; }
+    bool ok() const { return !failed; }
+};
+
+#endif
@@ -6,116 +6,1824 @@
 #include <iomanip>
 #include <random>
 #include <chrono>
-class WaveGrub {
+#include <unordered_map>
+#include <list>
+#include <deque>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <type_traits>
+#include <cstdint>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <fstream>
+#include <limits>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "wave_kernels.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "block_writer.h"
+#include "wave_file.h"
+#include "journal.h"
+
+// Computed goto (a GCC/Clang extension) drives the threaded engine; other
+// compilers run the same threaded code through a switch.
+#ifndef WAVEGRUB_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define WAVEGRUB_COMPUTED_GOTO 1
+#else
+#define WAVEGRUB_COMPUTED_GOTO 0
+#endif
+#endif
+
+// Profiling hooks in the interpreter and its helpers, switched on at run
+// time with --profile. Build with -DWAVEGRUB_PROFILE=0 to leave them out.
+#ifndef WAVEGRUB_PROFILE
+#define WAVEGRUB_PROFILE 1
+#endif
+
+#if WAVEGRUB_PROFILE
+// Times the enclosing block as one frame of prof, if there is one
+class ProfileScope {
 private:
-    std::vector<double> t;
-    std::vector<double> wave;
-    std::vector<double> ref_wave;
+    Profiler* prof;
+
+public:
+    ProfileScope(Profiler* p, const char* name, uint64_t key = 0, const char* text = nullptr, size_t length = 0) :
+        prof(p) {
+        if (prof) prof->enter(name, key, text, length);
+    }
+    ~ProfileScope() {
+        if (prof) prof->exit();
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profile_scope_, line)
+#define PROFILE_SCOPE(...) ProfileScope PROFILE_NAME(__LINE__)(profiler, __VA_ARGS__)
+#define PROFILE_SAMPLES(count) do { if (profiler) profiler->add_samples(count); } while (0)
+#else
+#define PROFILE_SCOPE(...)
+#define PROFILE_SAMPLES(count) do {} while (0)
+#endif
+
+// fmod(x, 2*pi) for |x| < 4*pi, usable in constant expressions. Exact, like
+// fmod: subtracting 2*pi from a value in [2*pi, 4*pi) loses no bits.
+constexpr double wrap_phase(double x) {
+    return x >= 2 * M_PI ? x - 2 * M_PI : x <= -2 * M_PI ? -(-x - 2 * M_PI) : x;
+}
+
+// std::min(std::max(x, lo), hi), usable in constant expressions.
+constexpr double clamp_value(double x, double lo, double hi) {
+    return hi < (x < lo ? lo : x) ? hi : (x < lo ? lo : x);
+}
+
+// x -> min(max(x + delta, lo), hi). Composing two of these gives another
+// one, so any run of clamped increments folds into a single step.
+struct ClampedStep {
+    double delta, lo, hi;
+
+    constexpr ClampedStep(double d = 0, double l = -INFINITY, double h = INFINITY) :
+        delta(d), lo(l), hi(h) {}
+
+    // This step followed by x -> min(max(x + d, l), h)
+    constexpr ClampedStep then(double d, double l, double h) const {
+        return ClampedStep(delta + d, clamp_value(lo + d, l, h), clamp_value(hi + d, l, h));
+    }
+
+    double apply(double x) const {
+        return std::min(std::max(x + delta, lo), hi);
+    }
+};
+
+// Net effect of a run of parameter ops (A/a, F/f, P/p, R).
+struct ParamUpdate {
+    bool reset;
+    ClampedStep amp, freq;
+    double phase_delta;
+
+    constexpr ParamUpdate(bool r = false, ClampedStep a = ClampedStep(), ClampedStep f = ClampedStep(),
+                          double p = 0) :
+        reset(r), amp(a), freq(f), phase_delta(p) {}
+
+    // This update followed by one more command. Anything but a parameter
+    // op leaves it unchanged.
+    constexpr ParamUpdate then(char cmd) const {
+        return cmd == 'A' ? ParamUpdate(reset, amp.then(0.1, -INFINITY, 2.0), freq, phase_delta)
+             : cmd == 'a' ? ParamUpdate(reset, amp.then(-0.1, 0.1, INFINITY), freq, phase_delta)
+             : cmd == 'F' ? ParamUpdate(reset, amp, freq.then(0.5, -INFINITY, 10.0), phase_delta)
+             : cmd == 'f' ? ParamUpdate(reset, amp, freq.then(-0.5, 0.5, INFINITY), phase_delta)
+             : cmd == 'P' ? ParamUpdate(reset, amp, freq, wrap_phase(phase_delta + 0.2))
+             : cmd == 'p' ? ParamUpdate(reset, amp, freq, wrap_phase(phase_delta - 0.2))
+             : cmd == 'R' ? ParamUpdate(true)
+             : *this;
+    }
+};
+
+enum class OpCode : unsigned char { Params, Buffer, Print, Random, Store, Load };
+
+inline const char* opcode_name(OpCode op) {
+    return op == OpCode::Params ? "params" : op == OpCode::Buffer ? "buffer"
+         : op == OpCode::Print ? "print" : op == OpCode::Random ? "random"
+         : op == OpCode::Store ? "store" : "load";
+}
+
+struct Instr {
+    OpCode op;
+    int arg;         // index into Program::params, Program::chains or Program::registers
+    int begin, end;  // source characters it came from
+};
+
+// A run of buffer ops, as a slice of Program::ops, and what they combine
+// the wave with: 0 for ref_wave, k + 1 for Program::registers[k]
+struct Chain {
+    int first, count;
+    int operand;
+};
+
+// Handlers of the threaded engine. The switch engine tracks whether the
+// wave is stale at run time; the threaded form resolves that when the
+// program is translated, so a handler that follows a parameter change
+// refreshes the wave itself and fuses with the op that reads it.
+enum class Handler : unsigned char {
+    ParamsPrint, ParamsBuffer, ParamsStore, ParamsEnd, Params,
+    Random, RandomPrint, RandomBuffer, RandomStore, RandomEnd,
+    Print, Buffer, Store, Load, End,
+    Count
+};
+
+struct ThreadedInstr {
+    const void* target;  // handler address when dispatching by computed goto
+    Handler handler;
+    int params, chain;
+    int reg;             // index into Program::registers for Store and Load
+};
+
+struct Program {
+    std::vector<Instr> code;
+    std::vector<ParamUpdate> params;
+    std::vector<WaveOp> ops;
+    std::vector<Chain> chains;
+    std::vector<std::string> registers;   // names, in order of first use
+    std::vector<int> slots;               // registers resolved by the WaveGrub that runs it
+    std::vector<ThreadedInstr> threaded;  // built on first threaded run
+};
+
+enum class Dispatch { Switch, Threaded };
+
+inline const char* dispatch_name(Dispatch d) {
+    return d == Dispatch::Switch ? "switch" : "threaded";
+}
+
+// The register named at code[at], if any: one digit, or a [name]. Returns
+// its index in prog.registers, adding it if new, and sets next past the
+// name; returns -1 if there is none.
+inline int parse_register(const std::string& code, size_t at, Program& prog, size_t& next) {
+    std::string name;
+    if (at < code.size() && code[at] >= '0' && code[at] <= '9') {
+        name = code.substr(at, 1);
+        next = at + 1;
+    } else if (at < code.size() && code[at] == '[') {
+        size_t close = code.find(']', at);
+        if (close == std::string::npos) return -1;
+        name = code.substr(at + 1, close - at - 1);
+        next = close + 1;
+    } else {
+        return -1;
+    }
+    for (size_t k = 0; k < prog.registers.size(); ++k) {
+        if (prog.registers[k] == name) return (int)k;
+    }
+    prog.registers.push_back(name);
+    return (int)prog.registers.size() - 1;
+}
+
+// Turns c+++ source into IR. Consecutive parameter ops collapse into one
+// ParamUpdate and consecutive buffer ops (*, +, -, /, I) into one chain
+// that runs as a single fused pass. Folded parameter runs can differ from
+// step-by-step evaluation in the last bit, since the increments are summed
+// first.
+//
+// Registers: >r stores the wave in register r and <r loads it back; *r,
+// +r, -r and /r combine the wave with r instead of ref_wave. r is a digit
+// or a [name]. A chain breaks where its operand changes.
+inline Program compile_program(const std::string& code) {
+    Program prog;
+    bool in_run = false, in_chain = false;
+    bool chain_operand = false;  // the open chain has an op that reads its operand
+    for (int i = 0; i < (int)code.size(); ++i) {
+        char cmd = code[i];
+        OpCode op;
+        WaveOp buffer_op;
+        size_t next;
+        int reg;
+        switch (cmd) {
+            case 'A': case 'a': case 'F': case 'f':
+            case 'P': case 'p': case 'R':
+                if (!in_run) {
+                    prog.params.push_back(ParamUpdate());
+                    prog.code.push_back({OpCode::Params, (int)prog.params.size() - 1, i, i});
+                    in_run = true;
+                }
+                prog.params.back() = prog.params.back().then(cmd);
+                prog.code.back().end = i + 1;
+                in_chain = false;
+                continue;
+            case '*': buffer_op = WaveOp::Mul; break;
+            case '+': buffer_op = WaveOp::Add; break;
+            case '-': buffer_op = WaveOp::Sub; break;
+            case '/': buffer_op = WaveOp::Div; break;
+            case 'I': buffer_op = WaveOp::Inverse; break;
+            case '=': op = OpCode::Print; goto barrier;
+            case 'N': op = OpCode::Random; goto barrier;
+            case '>':
+            case '<':
+                reg = parse_register(code, i + 1, prog, next);
+                if (reg < 0) continue;
+                prog.code.push_back({cmd == '>' ? OpCode::Store : OpCode::Load, reg, i, (int)next});
+                i = (int)next - 1;
+                in_run = in_chain = false;
+                continue;
+            default: continue;
+        }
+        {
+            int operand = 0;
+            bool reads = buffer_op != WaveOp::Inverse;
+            next = i + 1;
+            if (reads && (reg = parse_register(code, i + 1, prog, next)) >= 0) operand = reg + 1;
+            if (in_chain && reads && chain_operand && prog.chains.back().operand != operand) in_chain = false;
+            if (!in_chain) {
+                prog.chains.push_back({(int)prog.ops.size(), 0, 0});
+                prog.code.push_back({OpCode::Buffer, (int)prog.chains.size() - 1, i, i});
+                in_chain = true;
+                chain_operand = false;
+            }
+            if (reads && !chain_operand) {
+                prog.chains.back().operand = operand;
+                chain_operand = true;
+            }
+            prog.ops.push_back(buffer_op);
+            prog.code.back().end = (int)next;
+            ++prog.chains.back().count;
+            i = (int)next - 1;
+        }
+        in_run = false;
+        continue;
+    barrier:
+        prog.code.push_back({op, 0, i, i + 1});
+        in_run = in_chain = false;
+    }
+    return prog;
+}
+
+// Lowers prog.code into prog.threaded, pairing each parameter change or N
+// with the op that next reads the wave. Parameters set right before an N
+// are dropped, since N overwrites them unread. targets maps each Handler
+// to its address, or is null for the switch fallback.
+inline void thread_program(Program& prog, const void* const* targets) {
+    std::vector<ThreadedInstr>& out = prog.threaded;
+    const std::vector<Instr>& code = prog.code;
+    out.clear();
+    for (size_t i = 0; i < code.size(); ++i) {
+        const Instr& in = code[i];
+        const Instr* next = i + 1 < code.size() ? &code[i + 1] : nullptr;
+        ThreadedInstr t = {nullptr, Handler::End, in.arg, 0, 0};
+        switch (in.op) {
+            case OpCode::Params:
+            case OpCode::Random: {
+                bool params = in.op == OpCode::Params;
+                if (!next) {
+                    t.handler = params ? Handler::ParamsEnd : Handler::RandomEnd;
+                } else if (next->op == OpCode::Print) {
+                    t.handler = params ? Handler::ParamsPrint : Handler::RandomPrint;
+                    ++i;
+                } else if (next->op == OpCode::Buffer) {
+                    t.handler = params ? Handler::ParamsBuffer : Handler::RandomBuffer;
+                    t.chain = next->arg;
+                    ++i;
+                } else if (next->op == OpCode::Store) {
+                    t.handler = params ? Handler::ParamsStore : Handler::RandomStore;
+                    t.reg = next->arg;
+                    ++i;
+                } else if (next->op == OpCode::Load) {
+                    // The load replaces the wave, so it is not resynthesized
+                    t.handler = params ? Handler::Params : Handler::Random;
+                } else if (params) {
+                    continue;
+                } else {
+                    t.handler = Handler::Random;
+                }
+                break;
+            }
+            case OpCode::Print:
+                t.handler = Handler::Print;
+                break;
+            case OpCode::Buffer:
+                t.handler = Handler::Buffer;
+                t.chain = in.arg;
+                break;
+            case OpCode::Store:
+            case OpCode::Load:
+                t.handler = in.op == OpCode::Store ? Handler::Store : Handler::Load;
+                t.reg = in.arg;
+                break;
+        }
+        out.push_back(t);
+    }
+    out.push_back({nullptr, Handler::End, 0, 0, 0});
+    if (targets) {
+        for (ThreadedInstr& t : out) t.target = targets[(int)t.handler];
+    }
+}
+
+// t[i] = 2*pi*i/n and the reference sine wave for one wave size. They are
+// read-only once built, so every WaveGrub of a size shares one copy and
+// only the first construction pays for the sin() calls. The most recently
+// requested size stays cached even while no WaveGrub holds it.
+//
+// ref can instead come from a wave file (see reference_tables()); a
+// float64 wave is then read straight from the mapping.
+struct SampleTables {
+    AlignedBuffer t, own_ref;
+    std::shared_ptr<const WaveFile> file;  // keeps a mapped ref alive
+    const double* ref;
+
+    explicit SampleTables(int n) : t(n), own_ref(n), ref(own_ref.data()) {
+        for (int i = 0; i < n; ++i) {
+            t[i] = 2 * M_PI * i / n;
+            own_ref[i] = std::sin(t[i]);  // Reference wave is a simple sine wave
+        }
+    }
+
+    SampleTables(std::shared_ptr<const WaveFile> source, size_t index) :
+        t(source->samples()), own_ref(source->dtype() == WaveDType::Float64 ? 0 : source->samples()),
+        file(std::move(source)) {
+        const int n = (int)file->samples();
+        for (int i = 0; i < n; ++i) t[i] = 2 * M_PI * i / n;
+        ref = file->wave(index, own_ref.data());
+    }
+};
+
+inline std::shared_ptr<const SampleTables> sample_tables(int n) {
+    static std::mutex lock;
+    static std::unordered_map<int, std::weak_ptr<const SampleTables>> built;
+    static std::shared_ptr<const SampleTables> recent;
+    std::lock_guard<std::mutex> guard(lock);
+    std::shared_ptr<const SampleTables> tables = built[n].lock();
+    if (!tables) {
+        tables = std::make_shared<const SampleTables>(n);
+        built[n] = tables;
+    }
+    recent = tables;
+    return tables;
+}
+
+// Tables whose reference wave is wave `index` of a wave file
+inline std::shared_ptr<const SampleTables> reference_tables(const std::string& path, size_t index) {
+    std::shared_ptr<const WaveFile> file = std::make_shared<const WaveFile>(path);
+    if (index >= file->size()) {
+        throw std::runtime_error(path + " has " + std::to_string(file->size()) + " waves, no wave " +
+                                 std::to_string(index));
+    }
+    if (file->samples() > (size_t)std::numeric_limits<int>::max()) throw std::runtime_error(path + " waves are too long");
+    return std::make_shared<const SampleTables>(file, index);
+}
+
+// Compile-time front end for c+++ programs known at build time. These are
+// constexpr twins of compile_program(): the same IR, built by recursion
+// over the source text, with each instruction given its own params/chains
+// slot. Programs are limited by the compiler's constexpr and template
+// depth, a few hundred commands with the defaults.
+namespace fixed_detail {
+
+constexpr bool is_param(char c) {
+    return c == 'A' || c == 'a' || c == 'F' || c == 'f' || c == 'P' || c == 'p' || c == 'R';
+}
+
+constexpr bool is_buffer(char c) {
+    return c == '*' || c == '+' || c == '-' || c == '/' || c == 'I';
+}
+
+constexpr bool is_command(char c) {
+    return is_param(c) || is_buffer(c) || c == '=' || c == 'N';
+}
+
+constexpr WaveOp wave_op(char c) {
+    return c == '*' ? WaveOp::Mul : c == '+' ? WaveOp::Add : c == '-' ? WaveOp::Sub
+         : c == '/' ? WaveOp::Div : WaveOp::Inverse;
+}
+
+// First command at or after i
+constexpr size_t skip(const char* s, size_t i) {
+    return s[i] && !is_command(s[i]) ? skip(s, i + 1) : i;
+}
+
+// End of the parameter run or buffer chain starting at i. Unknown
+// characters don't break either, as in compile_program().
+constexpr size_t run_end(const char* s, size_t i, bool buffer) {
+    return s[i] && (!is_command(s[i]) || (buffer ? is_buffer(s[i]) : is_param(s[i])))
+        ? run_end(s, i + 1, buffer) : i;
+}
+
+constexpr size_t instr_end(const char* s, size_t i) {
+    return is_param(s[i]) ? run_end(s, i, false) : is_buffer(s[i]) ? run_end(s, i, true) : i + 1;
+}
+
+constexpr size_t instr_start(const char* s, size_t k, size_t i = 0) {
+    return k == 0 ? skip(s, i) : instr_start(s, k - 1, instr_end(s, skip(s, i)));
+}
+
+constexpr size_t instr_count(const char* s, size_t i = 0) {
+    return s[skip(s, i)] ? 1 + instr_count(s, instr_end(s, skip(s, i))) : 0;
+}
+
+constexpr size_t buffer_ops_before(const char* s, size_t end, size_t i = 0) {
+    return i == end ? 0 : (is_buffer(s[i]) ? 1 : 0) + buffer_ops_before(s, end, i + 1);
+}
+
+constexpr size_t buffer_op_count(const char* s, size_t i = 0) {
+    return s[i] ? (is_buffer(s[i]) ? 1 : 0) + buffer_op_count(s, i + 1) : 0;
+}
+
+// The k-th buffer op character at or after i
+constexpr WaveOp buffer_op(const char* s, size_t k, size_t i = 0) {
+    return !s[i] ? WaveOp::Inverse
+         : is_buffer(s[i]) ? (k == 0 ? wave_op(s[i]) : buffer_op(s, k - 1, i + 1))
+         : buffer_op(s, k, i + 1);
+}
+
+// Whether s has register syntax, which only compile_program() handles
+constexpr bool uses_registers(const char* s, size_t i = 0) {
+    return s[i] && (s[i] == '>' || s[i] == '<' ||
+                    ((s[i] == '*' || s[i] == '+' || s[i] == '-' || s[i] == '/') &&
+                     ((s[i + 1] >= '0' && s[i + 1] <= '9') || s[i + 1] == '[')) ||
+                    uses_registers(s, i + 1));
+}
+
+constexpr ParamUpdate fold(const char* s, size_t i, size_t end, ParamUpdate u) {
+    return i == end ? u : fold(s, i + 1, end, u.then(s[i]));
+}
+
+constexpr Instr instr(const char* s, size_t k) {
+    return Instr{is_param(s[instr_start(s, k)]) ? OpCode::Params
+                 : is_buffer(s[instr_start(s, k)]) ? OpCode::Buffer
+                 : s[instr_start(s, k)] == '=' ? OpCode::Print : OpCode::Random, (int)k,
+                 (int)instr_start(s, k), (int)instr_end(s, instr_start(s, k))};
+}
+
+constexpr ParamUpdate params(const char* s, size_t k) {
+    return is_param(s[instr_start(s, k)])
+        ? fold(s, instr_start(s, k), instr_end(s, instr_start(s, k)), ParamUpdate()) : ParamUpdate();
+}
+
+constexpr Chain chain(const char* s, size_t k) {
+    return is_buffer(s[instr_start(s, k)])
+        ? Chain{(int)buffer_ops_before(s, instr_start(s, k)),
+                (int)buffer_ops_before(s, instr_end(s, instr_start(s, k)), instr_start(s, k)), 0}
+        : Chain{0, 0, 0};
+}
+
+template <size_t... I> struct Indices {};
+template <size_t K, size_t... I> struct MakeIndices : MakeIndices<K - 1, K - 1, I...> {};
+template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+}  // namespace fixed_detail
+
+// The IR of Source::text() as constant data. Each array has one spare
+// element so empty programs still declare valid arrays.
+template <class Source,
+          class = typename fixed_detail::MakeIndices<fixed_detail::instr_count(Source::text())>::type,
+          class = typename fixed_detail::MakeIndices<fixed_detail::buffer_op_count(Source::text())>::type>
+struct FixedProgram;
+
+template <class Source, size_t... I, size_t... J>
+struct FixedProgram<Source, fixed_detail::Indices<I...>, fixed_detail::Indices<J...>> {
+    static_assert(!fixed_detail::uses_registers(Source::text()), "registers need interpret()");
+    static constexpr size_t size = sizeof...(I);
+    static constexpr Instr code[] = {fixed_detail::instr(Source::text(), I)..., Instr{OpCode::Print, 0, 0, 0}};
+    static constexpr ParamUpdate params[] = {fixed_detail::params(Source::text(), I)..., ParamUpdate()};
+    static constexpr Chain chains[] = {fixed_detail::chain(Source::text(), I)..., Chain{0, 0, 0}};
+    static constexpr WaveOp ops[] = {fixed_detail::buffer_op(Source::text(), J)..., WaveOp::Inverse};
+};
+
+template <class Source, size_t... I, size_t... J>
+constexpr Instr FixedProgram<Source, fixed_detail::Indices<I...>, fixed_detail::Indices<J...>>::code[];
+template <class Source, size_t... I, size_t... J>
+constexpr ParamUpdate FixedProgram<Source, fixed_detail::Indices<I...>, fixed_detail::Indices<J...>>::params[];
+template <class Source, size_t... I, size_t... J>
+constexpr Chain FixedProgram<Source, fixed_detail::Indices<I...>, fixed_detail::Indices<J...>>::chains[];
+template <class Source, size_t... I, size_t... J>
+constexpr WaveOp FixedProgram<Source, fixed_detail::Indices<I...>, fixed_detail::Indices<J...>>::ops[];
+
+// CPPP_FIXED("AAF=") is a FixedProgram for that source, to pass to
+// WaveGrub::run(). Nothing is parsed at run time.
+#define CPPP_FIXED(source) \
+    ([] { \
+        struct Source { \
+            static constexpr const char* text() { return source; } \
+        }; \
+        return FixedProgram<Source>(); \
+    }())
+
+// LRU cache of unit-amplitude waves keyed on the exact bits of (freq,
+// phase). The stepping commands keep revisiting the same few frequencies
+// and phases, and amplitude is a final multiply in every synthesis path
+// except the recurrence, so amp * cached sample is bit-identical to a
+// fresh synthesis. Holds at most budget / (n * 8) waves, and only admits
+// a key on its second miss so one-off parameters don't evict the rest.
+class WaveCache {
+private:
+    struct Key {
+        uint64_t freq, phase;
+        bool operator==(const Key& o) const { return freq == o.freq && phase == o.phase; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = (k.freq ^ (k.phase * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+            return (size_t)(h ^ (h >> 31));
+        }
+    };
+    struct Entry {
+        Key key;
+        AlignedBuffer samples;
+    };
+
+    static const size_t DOORKEEPER_SIZE = 1024;
+
+    int n;
+    size_t capacity;
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    size_t hit_count, miss_count;
+    std::vector<size_t> seen;  // Hashes of keys that missed once, by slot; allocated on first use
+
+public:
+    WaveCache(int samples, size_t budget) :
+        n(samples), hit_count(0), miss_count(0) {
+        set_budget(budget);
+    }
+
+    void set_budget(size_t bytes) {
+        capacity = bytes / (n * sizeof(double));
+        while (entries.size() > capacity) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    void clear() {
+        entries.clear();
+        index.clear();
+        std::fill(seen.begin(), seen.end(), 0);
+    }
+
+    // Returns the unit wave for (freq, phase) with found set, or on a miss
+    // a buffer to synthesize it into, reusing the least recently used
+    // entry once the budget is full. Returns nullptr when the key is not
+    // admitted, so the caller synthesizes the wave directly.
+    double* lookup(double freq, double phase, bool& found) {
+        Key key;
+        std::memcpy(&key.freq, &freq, sizeof(double));
+        std::memcpy(&key.phase, &phase, sizeof(double));
+        auto it = index.find(key);
+        found = it != index.end();
+        if (found) {
+            ++hit_count;
+            entries.splice(entries.begin(), entries, it->second);
+            return entries.front().samples.data();
+        }
+        ++miss_count;
+        if (capacity == 0) return nullptr;
+        size_t hash = KeyHash()(key);
+        if (seen.empty()) seen.assign(DOORKEEPER_SIZE, 0);
+        size_t& slot = seen[hash % DOORKEEPER_SIZE];
+        if (slot != hash) {
+            slot = hash;
+            return nullptr;
+        }
+        if (entries.size() >= capacity) {
+            index.erase(entries.back().key);
+            entries.splice(entries.begin(), entries, std::prev(entries.end()));
+        } else {
+            entries.push_front(Entry{key, AlignedBuffer(n)});
+        }
+        entries.front().key = key;
+        index[key] = entries.begin();
+        return entries.front().samples.data();
+    }
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+    size_t size() const { return entries.size(); }
+    size_t bytes() const { return entries.size() * n * sizeof(double); }
+};
+
+// The parameters behind the current wave
+struct WaveParams {
     double amp, freq, phase;
-    static const int SIZE = 256;
+};
+
+// Parameters and samples of many waves in one 64-byte aligned arena,
+// structure-of-arrays style: amp[], freq[] and phase[] are contiguous, and
+// wave i's samples are a row of the same arena padded to a cache line.
+// Every wave shares one t[]/ref table. interpret() runs a c+++ program on
+// all waves, or a subset, one instruction at a time across the whole
+// selection, so parameter ops are plain loops over the arrays and buffer
+// ops stream row after row. A WaveGrub can also be a view of one wave.
+class WaveBank {
+private:
+    int count, n, stride;
+    std::shared_ptr<const SampleTables> tables;
+    AlignedBuffer arena;
+    double *amps, *freqs, *phases, *rows;
+    WaveEngine engine;
+    std::default_random_engine generator;
+    std::ostream* out;
+
+    // Applies u to the selected waves. Phases stay in [0, 2*pi), where
+    // wrap_phase() equals the fmod() WaveGrub uses, so this matches it
+    // bit for bit.
+    template <class Select>
+    void apply_params(const ParamUpdate& u, Select select, size_t selected) {
+        for (size_t k = 0; k < selected; ++k) {
+            size_t i = select(k);
+            double a = u.reset ? 1 : amps[i], f = u.reset ? 1 : freqs[i], p = u.reset ? 0 : phases[i];
+            amps[i] = u.amp.apply(a);
+            freqs[i] = u.freq.apply(f);
+            p = wrap_phase(p + u.phase_delta);
+            phases[i] = p < 0 ? p + 2 * M_PI : p;
+        }
+    }
+
+    template <class Select>
+    void execute(const Program& prog, Select select, size_t selected) {
+        if (!prog.registers.empty()) throw std::invalid_argument("WaveBank programs cannot use registers");
+        bool stale = false;
+        auto refresh = [&] {
+            if (stale) {
+                for (size_t k = 0; k < selected; ++k) update_wave(select(k));
+            }
+            stale = false;
+        };
+        for (const Instr& in : prog.code) {
+            switch (in.op) {
+                case OpCode::Params:
+                    apply_params(prog.params[in.arg], select, selected);
+                    stale = true;
+                    break;
+                case OpCode::Random:
+                    for (size_t k = 0; k < selected; ++k) randomize_params(select(k));
+                    stale = true;
+                    break;
+                case OpCode::Print:
+                    refresh();
+                    for (size_t k = 0; k < selected; ++k) print_wave(select(k));
+                    break;
+                case OpCode::Buffer: {
+                    refresh();
+                    const Chain& chain = prog.chains[in.arg];
+                    for (size_t k = 0; k < selected; ++k) {
+                        apply_wave_ops(wave(select(k)), ref_wave(), n, prog.ops.data() + chain.first, chain.count);
+                    }
+                    break;
+                }
+                case OpCode::Store:
+                case OpCode::Load:
+                    break;
+            }
+        }
+        refresh();
+    }
+
+public:
+    WaveBank(int waves, int samples) :
+        count(waves), n(samples), stride((samples + 7) / 8 * 8), tables(sample_tables(samples)),
+        arena(3 * (size_t)((waves + 7) / 8 * 8) + (size_t)waves * stride), engine(WaveEngine::Kernel),
+        out(&std::cout) {
+        size_t columns = (waves + 7) / 8 * 8;
+        amps = arena.data();
+        freqs = amps + columns;
+        phases = freqs + columns;
+        rows = phases + columns;
+        std::fill(amps, amps + count, 1.0);
+        std::fill(freqs, freqs + count, 1.0);
+        for (int i = 0; i < count; ++i) update_wave(i);
+    }
+
+    WaveBank(const WaveBank&) = delete;
+    WaveBank& operator=(const WaveBank&) = delete;
+
+    int size() const { return count; }
+    int samples() const { return n; }
+    std::shared_ptr<const SampleTables> sample_table() const { return tables; }
+    const double* ref_wave() const { return tables->ref; }
+
+    double* wave(size_t i) { return rows + i * stride; }
+    const double* wave(size_t i) const { return rows + i * stride; }
+    double& amp(size_t i) { return amps[i]; }
+    double& freq(size_t i) { return freqs[i]; }
+    double& phase(size_t i) { return phases[i]; }
+    WaveParams wave_params(size_t i) const { return {amps[i], freqs[i], phases[i]}; }
+
+    void set_engine(WaveEngine e) { engine = e; }
+    void set_output(std::ostream& os) { out = &os; }
+
+    // Swaps in another reference wave of the same size (reference_tables()).
+    // Views made after this see it too.
+    void set_reference(std::shared_ptr<const SampleTables> reference) {
+        if ((int)reference->t.size() != n) throw std::invalid_argument("reference wave size differs from the bank");
+        tables = std::move(reference);
+    }
+    void seed(unsigned value) { generator.seed(value); }
+
+    void update_wave(size_t i) {
+        synthesize_wave(engine, wave(i), tables->t.data(), n, amps[i], freqs[i], phases[i]);
+    }
+
+    // Same draws and report as WaveGrub::randomize_params()
+    void randomize_params(size_t i) {
+        std::uniform_real_distribution<double> amp_dist(0.1, 2.0);
+        std::uniform_real_distribution<double> freq_dist(0.5, 10.0);
+        std::uniform_real_distribution<double> phase_dist(0, 2 * M_PI);
+        amps[i] = amp_dist(generator);
+        freqs[i] = freq_dist(generator);
+        phases[i] = phase_dist(generator);
+        *out << "Generated random wave with:\n";
+        *out << "Amp = " << amps[i] << ", Freq = " << freqs[i] << ", Phase = " << phases[i] << '\n';
+    }
+
+    // Same report as WaveGrub::print_waves()
+    void print_wave(size_t i) {
+        const int stride_out = std::max(1, n / 8);
+        const double* w = wave(i);
+        const double* ref = ref_wave();
+        *out << "Current wave parameters: Amp = " << amps[i] << ", Freq = " << freqs[i] << ", Phase = " << phases[i]
+             << '\n';
+        *out << "Wave:    ";
+        for (int k = 0; k < n; k += stride_out) *out << std::fixed << std::setprecision(2) << w[k] << " ";
+        *out << "\nRef Wave:";
+        for (int k = 0; k < n; k += stride_out) *out << std::fixed << std::setprecision(2) << ref[k] << " ";
+        *out << '\n';
+    }
+
+    // Output comes instruction by instruction: a line with two '=' prints
+    // every selected wave, then every one again.
+    void interpret(const std::string& code) {
+        execute(compile_program(code), [](size_t k) { return k; }, count);
+    }
+
+    // Runs code on the listed waves only, in the order given. Throws
+    // std::out_of_range, before running anything, if an index is not a wave.
+    void interpret(const std::string& code, const std::vector<int>& selection) {
+        for (int i : selection) {
+            if (i < 0 || i >= count) {
+                throw std::out_of_range("wave " + std::to_string(i) + " is not in a bank of " + std::to_string(count));
+            }
+        }
+        const int* picked = selection.data();
+        execute(compile_program(code), [picked](size_t k) { return (size_t)picked[k]; }, selection.size());
+    }
+};
+
+// N samples per wave, fixed at compile time so the per-sample loops get a
+// constant trip count, or N == 0 for a size chosen at construction. Sample
+// buffers are 64-byte aligned either way.
+template <int N = 256>
+class WaveGrub {
+private:
+    static const size_t PROGRAM_CACHE_LIMIT = 4096;
+    static const size_t WAVE_CACHE_BUDGET = 4 << 20;
+    static const size_t SPARE_BUFFERS = 8;
+
+    int n;
+    std::shared_ptr<const SampleTables> tables;
+    const double* t;
+    const double* ref_wave;
+    std::shared_ptr<AlignedBuffer> wave_buffer;  // null for a view of a WaveBank
+    double* wave;
+    WaveParams own_params;
+    double &amp, &freq, &phase;  // own_params, or the bank's slots
     std::default_random_engine generator;
+    std::unordered_map<std::string, Program> program_cache;
+    WaveEngine engine;
+    std::ostream* out;
+    WaveCache wave_cache;
+    Dispatch dispatch;
+    // Set by N until the next reset: random parameters are continuous and
+    // almost never repeat, so their waves would only churn the cache.
+    bool random_params;
+    Profiler* profiler;  // null unless profiling
+    uint64_t lines;      // lines interpreted, numbering the profiler's frames
+    WaveFileWriter* dump;  // gets every wave '=' prints, or null
+    // Registers by slot, and each name's slot. Storing shares the wave's
+    // buffer rather than copying it; whichever side writes next copies
+    // first (unshare_wave()). A view's wave lives in the bank, so a view
+    // copies when it stores or loads.
+    std::unordered_map<std::string, int> register_slots;
+    std::vector<std::shared_ptr<AlignedBuffer>> registers;
+    std::vector<std::shared_ptr<AlignedBuffer>> spare_buffers;  // unshared, for reuse
+    std::shared_ptr<AlignedBuffer> zeros;                       // what an empty register reads as
+
+    std::shared_ptr<AlignedBuffer> spare_buffer() {
+        if (spare_buffers.empty()) return std::make_shared<AlignedBuffer>(size());
+        std::shared_ptr<AlignedBuffer> buffer = std::move(spare_buffers.back());
+        spare_buffers.pop_back();
+        return buffer;
+    }
+
+    // Drops b, keeping its buffer for reuse if nothing else held it
+    void recycle(std::shared_ptr<AlignedBuffer>& b) {
+        if (b && b.use_count() == 1 && spare_buffers.size() < SPARE_BUFFERS) spare_buffers.push_back(std::move(b));
+        b.reset();
+    }
+
+    // Makes wave safe to write to, keeping its samples if keep is set
+    void unshare_wave(bool keep) {
+        if (!wave_buffer || wave_buffer.use_count() == 1) return;
+        std::shared_ptr<AlignedBuffer> fresh = spare_buffer();
+        if (keep) std::copy(wave, wave + size(), fresh->data());
+        wave_buffer = std::move(fresh);
+        wave = wave_buffer->data();
+    }
+
+    void resolve_registers(Program& prog) {
+        for (size_t k = prog.slots.size(); k < prog.registers.size(); ++k) {
+            auto it = register_slots.emplace(prog.registers[k], (int)registers.size()).first;
+            if (it->second == (int)registers.size()) registers.emplace_back();
+            prog.slots.push_back(it->second);
+        }
+    }
+
+    const double* register_wave(int slot) {
+        if (registers[slot]) return registers[slot]->data();
+        if (!zeros) zeros = std::make_shared<AlignedBuffer>(size());
+        return zeros->data();
+    }
+
+    void store_register(int slot) {
+        std::shared_ptr<AlignedBuffer>& r = registers[slot];
+        if (wave_buffer) {
+            if (r == wave_buffer) return;
+            recycle(r);
+            r = wave_buffer;
+        } else {
+            if (!r || r.use_count() > 1) {
+                recycle(r);
+                r = spare_buffer();
+            }
+            std::copy(wave, wave + size(), r->data());
+        }
+    }
+
+    void load_register(int slot) {
+        const std::shared_ptr<AlignedBuffer>& r = registers[slot];
+        if (!r) {
+            unshare_wave(false);
+            std::fill(wave, wave + size(), 0.0);
+        } else if (!wave_buffer) {
+            std::copy(r->data(), r->data() + size(), wave);
+        } else if (wave_buffer != r) {
+            recycle(wave_buffer);
+            wave_buffer = r;
+            wave = wave_buffer->data();
+        }
+    }
+
+    void run_chain(const WaveOp* ops, const Chain& chain, const int* slots) {
+        apply_buffer_chain(ops + chain.first, chain.count,
+                           chain.operand == 0 ? ref_wave : register_wave(slots[chain.operand - 1]));
+    }
 
 public:
-    WaveGrub() : 
-        t(SIZE), wave(SIZE), ref_wave(SIZE),
-        amp(1), freq(1), phase(0) {
+    explicit WaveGrub(int samples = N) :
+        n(N ? N : samples), tables(sample_tables(n)), t(tables->t.data()), ref_wave(tables->ref),
+        wave_buffer(std::make_shared<AlignedBuffer>(n)), wave(wave_buffer->data()), own_params{1, 1, 0},
+        amp(own_params.amp), freq(own_params.freq), phase(own_params.phase), engine(WaveEngine::Kernel),
+        out(&std::cout), wave_cache(n, WAVE_CACHE_BUDGET), dispatch(Dispatch::Threaded), random_params(false),
+        profiler(nullptr), lines(0), dump(nullptr) {
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+        generator = std::default_random_engine(seed);
+        update_wave();
+    }
+
+    // A view of wave `index` of bank: the full WaveGrub API, working on the
+    // bank's parameters and samples in place. It starts from the bank's
+    // current wave and has its wave cache off (see set_wave_cache_budget()).
+    WaveGrub(WaveBank& bank, int index) :
+        n(bank.samples()), tables(bank.sample_table()), t(tables->t.data()), ref_wave(tables->ref),
+        wave(bank.wave(index)), own_params{1, 1, 0},
+        amp(bank.amp(index)), freq(bank.freq(index)), phase(bank.phase(index)), engine(WaveEngine::Kernel),
+        out(&std::cout), wave_cache(n, 0), dispatch(Dispatch::Threaded), random_params(false),
+        profiler(nullptr), lines(0), dump(nullptr) {
+        if (N && bank.samples() != N) throw std::invalid_argument("bank wave size differs from WaveGrub<N>");
         unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
         generator = std::default_random_engine(seed);
-        for (int i = 0; i < SIZE; ++i) {
-            t[i] = 2 * M_PI * i / SIZE;
-            ref_wave[i] = std::sin(t[i]);  // Reference wave is a simple sine wave
+    }
+
+    WaveGrub(const WaveGrub&) = delete;
+    WaveGrub& operator=(const WaveGrub&) = delete;
+
+    int size() const { return N ? N : n; }
+
+    void update_wave() {
+        PROFILE_SCOPE("update_wave");
+        PROFILE_SAMPLES(size());
+        unshare_wave(false);
+        if (!random_params && engine != WaveEngine::Recurrence) {
+            bool found;
+            double* unit = wave_cache.lookup(freq, phase, found);
+            if (unit) {
+                if (!found) {
+                    PROFILE_SCOPE("synthesize");
+                    synthesize_wave(engine, unit, t, size(), 1.0, freq, phase);
+                }
+                double* w = wave;
+                for (int i = 0; i < size(); ++i) w[i] = amp * unit[i];
+                return;
+            }
+        }
+        PROFILE_SCOPE("synthesize");
+        synthesize_wave(engine, wave, t, size(), amp, freq, phase);
+    }
+
+    void set_engine(WaveEngine e) {
+        engine = e;
+        wave_cache.clear();
+        update_wave();
+    }
+
+    void set_wave_cache_budget(size_t bytes) {
+        wave_cache.set_budget(bytes);
+    }
+
+    // Replaces ref_wave with tables' reference, which must be the same size
+    void set_reference(std::shared_ptr<const SampleTables> reference) {
+        if ((int)reference->t.size() != size()) throw std::invalid_argument("reference wave size differs from WaveGrub");
+        tables = std::move(reference);
+        t = tables->t.data();
+        ref_wave = tables->ref;
+    }
+
+    // Appends the wave and its parameters to w on every '=', or stops if
+    // w is null. w must hold waves of size() samples.
+    void set_dump(WaveFileWriter* w) {
+        dump = w;
+    }
+
+    const WaveCache& cache() const { return wave_cache; }
+
+    void set_dispatch(Dispatch d) {
+        dispatch = d;
+    }
+
+    // Records into p from now on, or stops recording if p is null. Lines
+    // are numbered from 1 again.
+    void set_profiler(Profiler* p) {
+        profiler = p;
+        lines = 0;
+    }
+
+    const double* samples() const { return wave; }
+
+    WaveParams wave_params() const { return {amp, freq, phase}; }
+
+    // Hash of the parameters and samples, which a replayed session checks
+    uint64_t checksum() const {
+        const double params[3] = {amp, freq, phase};
+        return state_hash(wave, size(), state_hash(params, 3));
+    }
+
+    // Where print_waves() and N write. The REPL leaves this on std::cout;
+    // the batch runner gives each program its own buffer.
+    void set_output(std::ostream& os) {
+        out = &os;
+    }
+
+    // Reseeds the generator behind N so a run is reproducible.
+    void seed(unsigned value) {
+        generator.seed(value);
+    }
+
+    void random_wave() {
+        PROFILE_SCOPE("random_wave");
+        randomize_params();
+        update_wave();
+    }
+
+    void randomize_params() {
+        PROFILE_SCOPE("randomize_params");
+        std::uniform_real_distribution<double> amp_dist(0.1, 2.0);
+        std::uniform_real_distribution<double> freq_dist(0.5, 10.0);
+        std::uniform_real_distribution<double> phase_dist(0, 2 * M_PI);
+
+        amp = amp_dist(generator);
+        freq = freq_dist(generator);
+        phase = phase_dist(generator);
+        random_params = true;
+
+        *out << "Generated random wave with:\n";
+        *out << "Amp = " << amp << ", Freq = " << freq << ", Phase = " << phase << '\n';
+    }
+
+    Program& compiled(const std::string& code) {
+        PROFILE_SCOPE("compile");
+        auto it = program_cache.find(code);
+        if (it != program_cache.end()) return it->second;
+        if (program_cache.size() >= PROGRAM_CACHE_LIMIT) program_cache.clear();
+        return program_cache.emplace(code, compile_program(code)).first->second;
+    }
+
+    void apply_params(const ParamUpdate& u) {
+        if (u.reset) reset_wave();
+        amp = u.amp.apply(amp);
+        freq = u.freq.apply(freq);
+        phase = std::fmod(phase + u.phase_delta, 2 * M_PI);
+        if (phase < 0) phase += 2 * M_PI;
+    }
+
+    // Parameter ops redefine the wave, so it is only resynthesized when
+    // something next reads the samples. Buffer ops transform the current
+    // samples and their result persists until the parameters change.
+    // slots maps the program's registers to this WaveGrub's (see
+    // resolve_registers()); fixed programs have none.
+    void step(const Instr& in, const ParamUpdate* params, const WaveOp* ops, const Chain* chains, const int* slots,
+              bool& stale) {
+        switch (in.op) {
+            case OpCode::Params:
+                apply_params(params[in.arg]);
+                stale = true;
+                break;
+            case OpCode::Random:
+                randomize_params();
+                stale = true;
+                break;
+            case OpCode::Print:
+                if (stale) update_wave();
+                stale = false;
+                print_waves();
+                break;
+            case OpCode::Buffer:
+                if (stale) update_wave();
+                stale = false;
+                run_chain(ops, chains[in.arg], slots);
+                break;
+            case OpCode::Store:
+                if (stale) update_wave();
+                stale = false;
+                store_register(slots[in.arg]);
+                break;
+            case OpCode::Load:
+                load_register(slots[in.arg]);
+                stale = false;
+                break;
+        }
+    }
+
+    void execute(Program& prog) {
+        resolve_registers(prog);
+        bool stale = false;
+        for (const Instr& in : prog.code) {
+            step(in, prog.params.data(), prog.ops.data(), prog.chains.data(), prog.slots.data(), stale);
+        }
+        if (stale) update_wave();
+    }
+
+    // Unrolls a FixedProgram into one step() per instruction, each with its
+    // opcode and parameter update known to the compiler.
+    template <class P, size_t I>
+    typename std::enable_if<(I < P::size)>::type run_fixed(bool stale) {
+        step(P::code[I], P::params, P::ops, P::chains, nullptr, stale);
+        run_fixed<P, I + 1>(stale);
+    }
+
+    template <class P, size_t I>
+    typename std::enable_if<I == P::size>::type run_fixed(bool stale) {
+        if (stale) update_wave();
+    }
+
+    // Same semantics as execute(), run from the threaded form. With
+    // computed goto each handler jumps straight to the next one's address,
+    // so every op gets its own indirect branch to predict.
+    void execute_threaded(Program& prog) {
+#if WAVEGRUB_COMPUTED_GOTO
+        static const void* const targets[] = {
+            &&params_print, &&params_buffer, &&params_store, &&params_end, &&params,
+            &&random, &&random_print, &&random_buffer, &&random_store, &&random_end,
+            &&print, &&buffer, &&store, &&load, &&end,
+        };
+        static_assert(sizeof(targets) / sizeof(targets[0]) == (size_t)Handler::Count, "one target per handler");
+#define HANDLER(h, label) case Handler::h: label:
+#define NEXT { ++ip; goto *ip->target; }
+#else
+        static const void* const* const targets = nullptr;
+#define HANDLER(h, label) case Handler::h:
+#define NEXT { ++ip; continue; }
+#endif
+        if (prog.threaded.empty()) thread_program(prog, targets);
+        resolve_registers(prog);
+        const int* slots = prog.slots.data();
+        const ThreadedInstr* ip = prog.threaded.data();
+        for (;;) {
+            switch (ip->handler) {
+                HANDLER(ParamsPrint, params_print)
+                    apply_params(prog.params[ip->params]);
+                    update_wave();
+                    print_waves();
+                    NEXT
+                HANDLER(ParamsBuffer, params_buffer)
+                    apply_params(prog.params[ip->params]);
+                    update_wave();
+                    run_chain(prog.ops.data(), prog.chains[ip->chain], slots);
+                    NEXT
+                HANDLER(ParamsStore, params_store)
+                    apply_params(prog.params[ip->params]);
+                    update_wave();
+                    store_register(slots[ip->reg]);
+                    NEXT
+                HANDLER(ParamsEnd, params_end)
+                    apply_params(prog.params[ip->params]);
+                    update_wave();
+                    return;
+                HANDLER(Params, params)
+                    apply_params(prog.params[ip->params]);
+                    NEXT
+                HANDLER(Random, random)
+                    randomize_params();
+                    NEXT
+                HANDLER(RandomPrint, random_print)
+                    randomize_params();
+                    update_wave();
+                    print_waves();
+                    NEXT
+                HANDLER(RandomBuffer, random_buffer)
+                    randomize_params();
+                    update_wave();
+                    run_chain(prog.ops.data(), prog.chains[ip->chain], slots);
+                    NEXT
+                HANDLER(RandomStore, random_store)
+                    randomize_params();
+                    update_wave();
+                    store_register(slots[ip->reg]);
+                    NEXT
+                HANDLER(RandomEnd, random_end)
+                    randomize_params();
+                    update_wave();
+                    return;
+                HANDLER(Print, print)
+                    print_waves();
+                    NEXT
+                HANDLER(Buffer, buffer)
+                    run_chain(prog.ops.data(), prog.chains[ip->chain], slots);
+                    NEXT
+                HANDLER(Store, store)
+                    store_register(slots[ip->reg]);
+                    NEXT
+                HANDLER(Load, load)
+                    load_register(slots[ip->reg]);
+                    NEXT
+                HANDLER(End, end)
+                    return;
+                case Handler::Count:
+                    return;
+            }
+        }
+#undef HANDLER
+#undef NEXT
+    }
+
+    void apply_buffer_chain(const WaveOp* ops, int count, const double* operand) {
+        PROFILE_SCOPE("buffer_chain");
+        PROFILE_SAMPLES((uint64_t)size() * count);
+        unshare_wave(true);
+        apply_wave_ops(wave, operand, size(), ops, count);
+    }
+
+    void apply_buffer_chain(const WaveOp* ops, int count) {
+        apply_buffer_chain(ops, count, ref_wave);
+    }
+
+    void apply_buffer_op(WaveOp op) {
+        apply_buffer_chain(&op, 1);
+    }
+
+    void interpret(const std::string& code) {
+#if WAVEGRUB_PROFILE
+        if (profiler) {
+            profile_interpret(code);
+            return;
+        }
+#endif
+        if (dispatch == Dispatch::Threaded) execute_threaded(compiled(code));
+        else execute(compiled(code));
+    }
+
+#if WAVEGRUB_PROFILE
+    // execute() with a frame for the line and one per instruction, labelled
+    // with its span of the source. It runs on the switch engine whatever
+    // the dispatch setting, since the threaded one fuses instructions; the
+    // output is the same.
+    void profile_interpret(const std::string& code) {
+        PROFILE_SCOPE("line", ++lines);
+        Program& prog = compiled(code);
+        resolve_registers(prog);
+        bool stale = false;
+        for (const Instr& in : prog.code) {
+            PROFILE_SCOPE(opcode_name(in.op), (uint64_t)in.begin << 32 | (uint32_t)in.end,
+                          code.data() + in.begin, in.end - in.begin);
+            step(in, prog.params.data(), prog.ops.data(), prog.chains.data(), prog.slots.data(), stale);
+        }
+        if (stale) update_wave();
+    }
+#endif
+
+    // Runs a program folded at compile time; see CPPP_FIXED.
+    template <class P>
+    void run(const P&) {
+        run_fixed<P, 0>(false);
+    }
+
+    void inverse_wave() {
+        apply_buffer_op(WaveOp::Inverse);
+    }
+
+    void reset_wave() {
+        amp = 1;
+        freq = 1;
+        phase = 0;
+        random_params = false;
+    }
+
+    void print_waves() {
+        PROFILE_SCOPE("print_waves");
+        const int stride = std::max(1, size() / 8);
+        PROFILE_SAMPLES(2 * ((size() + stride - 1) / stride));
+        *out << "Current wave parameters: Amp = " << amp << ", Freq = " << freq << ", Phase = " << phase << '\n';
+        *out << "Wave:    ";
+        for (int i = 0; i < size(); i += stride) 
+            *out << std::fixed << std::setprecision(2) << wave[i] << " ";
+        *out << "\nRef Wave:";
+        for (int i = 0; i < size(); i += stride) 
+            *out << std::fixed << std::setprecision(2) << ref_wave[i] << " ";
+        *out << '\n';
+        if (dump) dump->append(wave, WaveFileParams{amp, freq, phase});
+    }
+};
+
+// Reports each sine kernel path's error against std::sin over the t[]
+// grid for the full c+++ frequency range. Every ISA level up to the one
+// dispatched to is checked, and each must match the scalar path bit for bit.
+// 253 samples leave a partial vector at the end for every lane width.
+int check_sine() {
+    bool ok = true;
+    for (int n : {256, 253}) {
+        std::vector<double> t(n);
+        for (int i = 0; i < n; ++i) t[i] = 2 * M_PI * i / n;
+        for (int level = 0; level <= (int)sine_isa(); ++level) {
+            SineIsa isa = static_cast<SineIsa>(level);
+            SineErrorReport report = check_sine_kernel(isa, t.data(), n, 10.0);
+            bool good = report.max_ulp <= SINE_MAX_ULP && report.max_abs <= SINE_MAX_ABS_ERROR &&
+                        report.mismatches == 0;
+            std::cout << "Sine kernel (" << sine_isa_name(isa) << ", n=" << n << "): max error "
+                      << report.max_ulp << " ulp, " << report.max_abs << " abs (bound " << SINE_MAX_ULP << " ulp, "
+                      << SINE_MAX_ABS_ERROR << " abs), " << report.mismatches << " samples differ from scalar "
+                      << (good ? "OK" : "FAILED") << std::endl;
+            ok = ok && good;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// Reports the recurrence engine's drift against std::sin for wave sizes
+// from a few samples to well past several anchors.
+int check_recurrence() {
+    static const int sizes[] = {1, 3, 16, 64, 100, 256, 1000, 4096};
+    bool ok = true;
+    for (int n : sizes) {
+        double error = check_recurrence_kernel(n, 10.0);
+        bool good = error <= RECURRENCE_MAX_ABS_ERROR;
+        std::cout << "Recurrence n=" << n << ": max error " << error << " abs (bound "
+                  << RECURRENCE_MAX_ABS_ERROR << ") " << (good ? "OK" : "FAILED") << std::endl;
+        ok = ok && good;
+    }
+    return ok ? 0 : 1;
+}
+
+// Runs random programs through both dispatch engines from the same seed
+// and reports any line where their output or samples differ.
+int check_dispatch() {
+    static const char alphabet[] = "AaFfPpRN=*+-/I x<>01[]";
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> pick(0, sizeof(alphabet) - 2);
+    std::uniform_int_distribution<int> length(0, 64);
+    WaveGrub<256> switched, threaded;
+    std::ostringstream switched_out, threaded_out;
+    switched.set_output(switched_out);
+    threaded.set_output(threaded_out);
+    switched.set_dispatch(Dispatch::Switch);
+    threaded.set_dispatch(Dispatch::Threaded);
+    switched.seed(1);
+    threaded.seed(1);
+
+    const int lines = 100000;
+    int mismatches = 0;
+    for (int i = 0; i < lines; ++i) {
+        std::string line;
+        for (int k = length(generator); k > 0; --k) line += alphabet[pick(generator)];
+        switched.interpret(line);
+        threaded.interpret(line);
+        if (switched_out.str() != threaded_out.str() ||
+            std::memcmp(switched.samples(), threaded.samples(), switched.size() * sizeof(double)) != 0) {
+            if (mismatches++ == 0) std::cout << "First mismatch on: " << line << std::endl;
+        }
+        switched_out.str("");
+        threaded_out.str("");
+    }
+    std::cout << "Dispatch check: " << lines << " programs, " << mismatches << " mismatches "
+              << (mismatches == 0 ? "OK" : "FAILED") << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+// Runs programs folded at compile time next to the same source through
+// interpret() and reports any that differ in output or samples.
+template <class P>
+bool fixed_matches(const std::string& source, const P& program) {
+    WaveGrub<256> interpreted, fixed;
+    std::ostringstream interpreted_out, fixed_out;
+    interpreted.set_output(interpreted_out);
+    fixed.set_output(fixed_out);
+    interpreted.seed(1);
+    fixed.seed(1);
+    interpreted.interpret(source);
+    fixed.run(program);
+    bool same = interpreted_out.str() == fixed_out.str() &&
+                std::memcmp(interpreted.samples(), fixed.samples(), fixed.size() * sizeof(double)) == 0;
+    if (!same) std::cout << "Mismatch on: " << source << std::endl;
+    return same;
+}
+
+int check_fixed() {
+#define CHECK_FIXED(source) fixed_matches(source, CPPP_FIXED(source))
+    bool ok = CHECK_FIXED("") & CHECK_FIXED("x") & CHECK_FIXED("AAF=") & CHECK_FIXED("Ax F*+-/I=N=RaAf") &
+              CHECK_FIXED("N*NN") & CHECK_FIXED("I=I=I=*/+-PPpF=RR=") & CHECK_FIXED("=*=") &
+              CHECK_FIXED("PPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPPP=pppppppppppppppppppppppppppppppppppppppp*=") &
+              CHECK_FIXED("FFFFFFFFFFFFFFFFFFFFFFAAAAAAAAAAAAAAAAAAAAaaaaaaaaaaaaaaaaaaaaaaaffffffffffffffffffffff=");
+#undef CHECK_FIXED
+    std::cout << "Fixed program check " << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+template <class Grub>
+double time_per_sample(Grub& wg, int reps, void (*kernel)(Grub&)) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) kernel(wg);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / ((double)reps * wg.size());
+}
+
+template <class Grub>
+void bench_size(Grub& wg, const char* variant) {
+    struct Kernel {
+        const char* name;
+        void (*run)(Grub&);
+    };
+    static const Kernel kernels[] = {
+        // Ops run in inverse pairs so repeated passes don't drift the
+        // samples into denormals
+        {"update_wave", [](Grub& g) { g.update_wave(); }},
+        {"mul+div", [](Grub& g) { g.apply_buffer_op(WaveOp::Mul); g.apply_buffer_op(WaveOp::Div); }},
+        {"add+sub", [](Grub& g) { g.apply_buffer_op(WaveOp::Add); g.apply_buffer_op(WaveOp::Sub); }},
+        {"inverse", [](Grub& g) { g.inverse_wave(); }},
+        {"fused x6", [](Grub& g) {
+            static const WaveOp chain[] = {WaveOp::Mul, WaveOp::Add, WaveOp::Sub,
+                                           WaveOp::Div, WaveOp::Inverse, WaveOp::Inverse};
+            g.apply_buffer_chain(chain, 6);
+        }},
+    };
+    const double work = 1 << 26;  // samples per measurement
+    int reps = std::max(1, (int)(work / wg.size()));
+    for (const Kernel& k : kernels) {
+        wg.update_wave();
+        double ns = time_per_sample(wg, reps, k.run);
+        std::cout << std::setw(10) << wg.size() << "  " << std::setw(8) << variant << "  "
+                  << std::setw(12) << k.name << "  " << std::fixed << std::setprecision(3)
+                  << std::setw(9) << ns << "  " << std::setprecision(1) << std::setw(10)
+                  << 1e3 / ns << std::endl;
+    }
+}
+
+// Throughput of the per-sample kernels from 256 to 16M samples, for the
+// compile-time 256-sample wave and the runtime-sized one.
+int bench_sizes() {
+    std::cout << "      size   variant        kernel  ns/sample  Msamples/s" << std::endl;
+    {
+        WaveGrub<256> fixed;
+        bench_size(fixed, "fixed");
+    }
+    for (int samples = 256; samples <= (1 << 24); samples *= 16) {
+        WaveGrub<0> dynamic(samples);
+        bench_size(dynamic, "runtime");
+    }
+    return 0;
+}
+
+// One c+++ program for the batch runner: either a line of a corpus file or
+// a whole file from a directory, which is mapped only when it runs.
+struct BatchProgram {
+    std::string name;
+    std::string path;      // set for directory entries
+    const char* text;      // set for corpus lines
+    size_t length;
+};
+
+struct BatchOptions {
+    unsigned threads = 0;
+    unsigned seed = 0;
+    int samples = 256;
+    WaveEngine engine = WaveEngine::Kernel;
+    size_t wave_cache_bytes = 4 << 20;
+    Dispatch dispatch = Dispatch::Threaded;
+    Profiler* profiler = nullptr;  // receives every worker's profile when set
+    std::shared_ptr<const SampleTables> reference;  // ref_wave for every program, or null for the sine
+};
+
+// Runs one program against a fresh WaveGrub, line by line like the REPL,
+// and returns everything it printed.
+template <class Grub>
+std::string run_batch_program(Grub& wg, const BatchProgram& program, size_t index, const BatchOptions& options,
+                              Profiler* profiler = nullptr) {
+    MappedFile file;
+    const char* text = program.text;
+    size_t length = program.length;
+    if (!program.path.empty()) {
+        file = MappedFile(program.path);
+        text = file.data();
+        length = file.size();
+    }
+
+    std::ostringstream output;
+    std::seed_seq seq{options.seed, (unsigned)index, (unsigned)(index >> 32)};
+    unsigned seed;
+    seq.generate(&seed, &seed + 1);
+    wg.seed(seed);
+    wg.set_engine(options.engine);
+    wg.set_wave_cache_budget(options.wave_cache_bytes);
+    wg.set_dispatch(options.dispatch);
+    wg.set_output(output);
+    wg.set_profiler(profiler);
+    if (options.reference) wg.set_reference(options.reference);
+#if WAVEGRUB_PROFILE
+    ProfileScope scope(profiler, "program", index + 1, program.name.data(), program.name.size());
+#endif
+
+    output << "# " << program.name << '\n';
+    size_t pos = 0;
+    while (pos < length) {
+        const char* end = static_cast<const char*>(std::memchr(text + pos, '\n', length - pos));
+        size_t line_end = end ? end - text : length;
+        std::string line(text + pos, line_end - pos);
+        pos = line_end + 1;
+        if (line == "quit") break;
+        wg.interpret(line);
+    }
+    return output.str();
+}
+
+// Non-interactive mode: runs every program in a corpus file (one program
+// per line) or directory (one program per file, in name order) on a
+// thread pool. Each program gets its own WaveGrub, output buffer and
+// random seed derived from --seed and its position, and the outputs are written
+// in input order, so a run is reproducible at any thread count.
+int run_batch(const std::string& path, const BatchOptions& options) {
+    std::vector<BatchProgram> programs;
+    MappedFile corpus;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return 1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = ::opendir(path.c_str());
+        if (!dir) {
+            std::cerr << "Cannot open " << path << std::endl;
+            return 1;
+        }
+        while (dirent* entry = ::readdir(dir)) {
+            std::string full = path + "/" + entry->d_name;
+            struct stat entry_st;
+            if (::stat(full.c_str(), &entry_st) == 0 && S_ISREG(entry_st.st_mode)) {
+                programs.push_back({entry->d_name, full, nullptr, 0});
+            }
+        }
+        ::closedir(dir);
+        std::sort(programs.begin(), programs.end(),
+                  [](const BatchProgram& a, const BatchProgram& b) { return a.name < b.name; });
+    } else {
+        try {
+            corpus = MappedFile(path);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        const char* text = corpus.data();
+        size_t pos = 0, line = 1;
+        while (pos < corpus.size()) {
+            const char* end = static_cast<const char*>(std::memchr(text + pos, '\n', corpus.size() - pos));
+            size_t line_end = end ? end - text : corpus.size();
+            programs.push_back({"line " + std::to_string(line++), "", text + pos, line_end - pos});
+            pos = line_end + 1;
         }
-        update_wave();
     }
 
-    void update_wave() {
-        for (int i = 0; i < SIZE; ++i) {
-            wave[i] = amp * std::sin(freq * t[i] + phase);
+    WorkStealingPool pool(options.threads);
+    const size_t CHUNK = 4096;  // bounds the outputs held in memory
+    std::vector<std::string> outputs;
+    // One profile per worker, merged at the end, so workers never share one
+    std::vector<std::unique_ptr<Profiler>> profiles;
+    if (options.profiler) {
+        for (unsigned i = 0; i < pool.size(); ++i) profiles.emplace_back(new Profiler());
+    }
+    for (size_t first = 0; first < programs.size(); first += CHUNK) {
+        size_t count = std::min(CHUNK, programs.size() - first);
+        outputs.assign(count, std::string());
+        pool.run(count, [&](unsigned worker, size_t k) {
+            const BatchProgram& program = programs[first + k];
+            Profiler* profiler = options.profiler ? profiles[worker].get() : nullptr;
+            try {
+                if (options.samples == 256) {
+                    WaveGrub<256> wg;
+                    outputs[k] = run_batch_program(wg, program, first + k, options, profiler);
+                } else {
+                    WaveGrub<0> wg(options.samples);
+                    outputs[k] = run_batch_program(wg, program, first + k, options, profiler);
+                }
+            } catch (const std::exception& e) {
+                outputs[k] = "# " + program.name + "\nError: " + e.what() + "\n";
+            }
+        });
+        for (const std::string& text : outputs) std::cout.write(text.data(), text.size());
+    }
+    std::cout.flush();
+    for (const std::unique_ptr<Profiler>& profile : profiles) options.profiler->merge(*profile);
+    return 0;
+}
+
+// --profile prints the summary to stderr, with the slowest frames named
+// top (source lines, or batch programs); --profile-folded writes folded
+// stacks for flamegraph.pl or speedscope.
+int write_profile(const Profiler& profiler, bool summary, const std::string& folded_path, const char* top) {
+    if (summary) {
+        std::cerr << "\nProfile:\n";
+        profiler.write_summary(std::cerr);
+        std::cerr << "\nSlowest " << top << "s:\n";
+        profiler.write_top(std::cerr, top, 10);
+    }
+    if (!folded_path.empty()) {
+        std::ofstream folded(folded_path);
+        profiler.write_folded(folded);
+        if (!folded) {
+            std::cerr << "Cannot write " << folded_path << std::endl;
+            return 1;
         }
     }
+    return 0;
+}
 
-    void random_wave() {
-        std::uniform_real_distribution<double> amp_dist(0.1, 2.0);
-        std::uniform_real_distribution<double> freq_dist(0.5, 10.0);
-        std::uniform_real_distribution<double> phase_dist(0, 2 * M_PI);
+// Unbounded, phase-continuous rendering of amp * sin(theta + phase), where
+// theta advances 2*pi*freq*base_hz/rate per sample. The running phase
+// carries across blocks, so a frequency change never clicks. New
+// parameters take effect at the start of a block; with ramp > 0, amp, freq
+// and phase glide linearly to them over the block's first ramp samples.
+// Blocks run through the same sine kernel as update_wave() and render()
+// allocates nothing.
+class WaveStream {
+private:
+    int block, ramp;
+    double rate, base_hz;
+    double theta;  // running phase at the start of the next block, in [0, 2*pi)
+    WaveParams current;
+    AlignedBuffer index, args, gains, samples;
 
-        amp = amp_dist(generator);
-        freq = freq_dist(generator);
-        phase = phase_dist(generator);
+    double step(double freq) const {
+        return 2 * M_PI * freq * base_hz / rate;
+    }
 
-        update_wave();
-        std::cout << "Generated random wave with:" << std::endl;
-        std::cout << "Amp = " << amp << ", Freq = " << freq << ", Phase = " << phase << std::endl;
+public:
+    WaveStream(int block_samples, double sample_rate, double base, int ramp_samples, const WaveParams& start) :
+        block(block_samples), ramp(std::min(ramp_samples, block_samples)), rate(sample_rate), base_hz(base),
+        theta(0), current(start), index(block), args(block), gains(block), samples(block) {
+        for (int i = 0; i < block; ++i) index[i] = i;
     }
 
-    void interpret(const std::string& code) {
-        for (char cmd : code) {
-            switch (cmd) {
-                case 'A': amp = std::min(amp + 0.1, 2.0); break;
-                case 'a': amp = std::max(amp - 0.1, 0.1); break;
-                case 'F': freq = std::min(freq + 0.5, 10.0); break;
-                case 'f': freq = std::max(freq - 0.5, 0.5); break;
-                case 'P': phase = std::fmod(phase + 0.2, 2 * M_PI); break;
-                case 'p': phase = std::fmod(phase - 0.2 + 2 * M_PI, 2 * M_PI); break;
-                case '*':
-                    for (int j = 0; j < SIZE; ++j) wave[j] *= ref_wave[j];
-                    break;
-                case '+':
-                    for (int j = 0; j < SIZE; ++j) wave[j] += ref_wave[j];
-                    break;
-                case '-':
-                    for (int j = 0; j < SIZE; ++j) wave[j] -= ref_wave[j];
-                    break;
-                case '/':
-                    for (int j = 0; j < SIZE; ++j) {
-                        if (ref_wave[j] != 0) wave[j] /= ref_wave[j];
-                        else wave[j] = 0;  // Avoid division by zero
-                    }
-                    break;
-                case 'I':
-                    inverse_wave();
-                    break;
-                case '=':
-                    print_waves();
-                    break;
-                case 'R':
-                    reset_wave();
-                    break;
-                case 'N':
-                    random_wave();
-                    break;
+    void render(float* out, const WaveParams& next) {
+        int i = 0;
+        if (ramp > 0 && (next.amp != current.amp || next.freq != current.freq || next.phase != current.phase)) {
+            const double from = step(current.freq), to = step(next.freq);
+            double turn = std::fmod(next.phase - current.phase, 2 * M_PI);  // the short way round
+            if (turn > M_PI) turn -= 2 * M_PI;
+            if (turn < -M_PI) turn += 2 * M_PI;
+            double th = theta;
+            for (; i < ramp; ++i) {
+                double x = (i + 1.0) / ramp;
+                args[i] = th + current.phase + turn * x;
+                gains[i] = current.amp + (next.amp - current.amp) * x;
+                th += from + (to - from) * x;
             }
-            update_wave();
+            sine_wave(samples.data(), args.data(), ramp, 1.0, 1.0, 0.0);
+            for (int k = 0; k < ramp; ++k) samples[k] *= gains[k];
+            theta = std::fmod(th, 2 * M_PI);
         }
+        current = next;
+        const double d = step(current.freq);
+        if (i < block) {
+            sine_wave(samples.data() + i, index.data(), block - i, current.amp, d, theta + current.phase);
+            theta = std::fmod(theta + d * (block - i), 2 * M_PI);
+        }
+        for (int k = 0; k < block; ++k) out[k] = (float)samples[k];
     }
+};
 
-    void inverse_wave() {
-        for (int i = 0; i < SIZE; ++i) {
-            if (wave[i] != 0) wave[i] = 1 / wave[i];
-            else wave[i] = 0;  // Avoid division by zero
+struct StreamOptions {
+    std::string path = "-";  // "-" for stdout
+    BlockWriter::Format format = BlockWriter::Raw;
+    double rate = 48000;
+    int block = 1024;
+    int ramp = 0;
+    double base_hz = 0;  // 0 for rate / wave size: freq counts cycles per wave, as in print_waves()
+    bool realtime = false;
+    int hold = 1;         // without --realtime, blocks each input line lasts
+    double duration = 0;  // seconds of output, or 0 to stop at the end of input
+};
+
+// Reads c+++ lines from fd 0 on its own thread for the real-time stream,
+// interpreting each and queueing the resulting parameters. Polls so that
+// stop() never waits on a read.
+template <class Grub>
+class StreamControl {
+private:
+    Grub& wg;
+    std::unique_ptr<SpscRing<WaveParams, 64>> ring;
+    std::atomic<bool> stopping, finished;
+    std::thread reader;
+
+    void read_lines() {
+        std::string pending, line;
+        char buffer[4096];
+        while (!stopping.load(std::memory_order_relaxed)) {
+            pollfd p = {0, POLLIN, 0};
+            int ready = ::poll(&p, 1, 50);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready <= 0) continue;
+            ssize_t k = ::read(0, buffer, sizeof(buffer));
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) break;
+            pending.append(buffer, k);
+            size_t end;
+            while ((end = pending.find('\n')) != std::string::npos) {
+                line.assign(pending, 0, end);
+                pending.erase(0, end + 1);
+                if (line == "quit") {
+                    finished.store(true, std::memory_order_release);
+                    return;
+                }
+                wg.interpret(line);
+                WaveParams params = wg.wave_params();
+                while (!ring->try_push(params) && !stopping.load(std::memory_order_relaxed)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
         }
+        finished.store(true, std::memory_order_release);
     }
 
-    void reset_wave() {
-        amp = 1;
-        freq = 1;
-        phase = 0;
+public:
+    explicit StreamControl(Grub& g) :
+        wg(g), ring(new SpscRing<WaveParams, 64>()), stopping(false), finished(false) {
+        reader = std::thread(&StreamControl::read_lines, this);
     }
 
-    void print_waves() {
-        std::cout << "Current wave parameters: Amp = " << amp << ", Freq = " << freq << ", Phase = " << phase << std::endl;
-        std::cout << "Wave:    ";
-        for (int i = 0; i < SIZE; i += SIZE/8) 
-            std::cout << std::fixed << std::setprecision(2) << wave[i] << " ";
-        std::cout << "\nRef Wave:";
-        for (int i = 0; i < SIZE; i += SIZE/8) 
-            std::cout << std::fixed << std::setprecision(2) << ref_wave[i] << " ";
-        std::cout << std::endl;
+    ~StreamControl() { stop(); }
+
+    // Latest queued parameters, if any
+    bool poll(WaveParams& params) {
+        bool got = false;
+        while (ring->try_pop(params)) got = true;
+        return got;
+    }
+
+    // True once input has ended. Every update is queued by then, so a
+    // poll() after this returns the last of them.
+    bool input_ended() const {
+        return finished.load(std::memory_order_acquire);
+    }
+
+    void stop() {
+        if (!reader.joinable()) return;
+        stopping.store(true, std::memory_order_relaxed);
+        reader.join();
     }
 };
 
-int main() {
-    WaveGrub wg;
+// Streams the wave as float samples while reading c+++ commands from
+// stdin. Without --realtime the input is a script: each line holds for
+// --hold blocks, and the output is the same on every run. With --realtime
+// blocks are paced to the sample rate and a line takes effect at the
+// first block boundary after it arrives. Printed waves and N's report go to
+// stderr, since stdout may be the stream.
+template <class Grub>
+int run_stream(Grub& wg, const StreamOptions& options) {
+    wg.set_output(std::cerr);
+    const double base_hz = options.base_hz > 0 ? options.base_hz : options.rate / wg.size();
+    const uint64_t max_blocks = options.duration > 0
+        ? (uint64_t)std::ceil(options.duration * options.rate / options.block) : UINT64_MAX;
+    // A reader that goes away should end the stream with a failed write and
+    // the statistics, not kill the process
+    ::signal(SIGPIPE, SIG_IGN);
+    std::unique_ptr<BlockWriter> writer;
+    try {
+        writer.reset(new BlockWriter(options.path, options.format, options.block, (uint32_t)options.rate));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    const WaveParams initial = wg.wave_params();
+    WaveStream stream(options.block, options.rate, base_hz, options.ramp, initial);
+
+    // Time spent rendering each block, the part the stream itself controls
+    double render_total = 0, render_max = 0;
+    uint64_t blocks = 0;
+    bool ok = true;
+    auto emit = [&](const WaveParams& params) {
+        float* out = writer->acquire();
+        auto start = std::chrono::steady_clock::now();
+        stream.render(out, params);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        render_total += ns;
+        render_max = std::max(render_max, ns);
+        ++blocks;
+        ok = writer->submit();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if (options.realtime) {
+        // The control thread owns wg until stop()
+        WaveParams params = initial;
+        StreamControl<Grub> control(wg);
+        const double period = options.block / options.rate;
+        while (ok && blocks < max_blocks) {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(blocks * period)));
+            bool ended = control.input_ended();
+            bool changed = control.poll(params);
+            if (ended && !changed && options.duration <= 0) break;
+            emit(params);
+        }
+        control.stop();
+    } else {
+        std::string line;
+        bool input = true;
+        while (ok && blocks < max_blocks) {
+            if (input) {
+                if (std::getline(std::cin, line) && line != "quit") {
+                    wg.interpret(line);
+                } else {
+                    input = false;
+                    if (options.duration <= 0) break;
+                }
+            }
+            const WaveParams params = wg.wave_params();
+            for (int h = 0; ok && blocks < max_blocks && (h < options.hold || !input); ++h) emit(params);
+        }
+    }
+    writer->close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ok = ok && writer->ok();
+
+    std::cerr << "Streamed " << blocks << " blocks of " << options.block << " samples ("
+              << blocks * options.block / options.rate << " s at " << options.rate << " Hz) in " << seconds
+              << " s; render " << (blocks ? render_total / blocks : 0.0) << " ns/block mean, " << render_max
+              << " ns max" << std::endl;
+    if (!ok) std::cerr << "Stream write failed" << std::endl;
+    return ok ? 0 : 1;
+}
+
+template <class Grub>
+void run_repl(Grub& wg, bool cache_stats, JournalWriter* journal = nullptr) {
     std::string input;
 
     std::cout << "Welcome to c+++ Interactive Interpreter!" << std::endl;
@@ -131,19 +1839,1070 @@ int main() {
     std::cout << "  = (print waves)" << std::endl;
     std::cout << "  R (reset wave to initial state)" << std::endl;
     std::cout << "  N (generate a new random wave)" << std::endl;
+    std::cout << "  >r / <r (store the wave in / load it from register r, a digit or [name])" << std::endl;
+    std::cout << "  *r +r -r /r (combine with register r instead of the reference wave)" << std::endl;
     std::cout << "Enter commands (or 'quit' to exit):" << std::endl;
 
     while (true) {
         std::cout << "> ";
-        std::getline(std::cin, input);
-        
+        if (!std::getline(std::cin, input)) break;
+
         if (input == "quit") {
             break;
         }
 
         wg.interpret(input);
+        if (journal) {
+            journal->text('L', input);
+            journal->u64('H', wg.checksum());
+            journal->flush();
+        }
     }
 
+    if (cache_stats) {
+        const WaveCache& cache = wg.cache();
+        std::cout << "Wave cache: " << cache.hits() << " hits, " << cache.misses() << " misses, "
+                  << cache.size() << " waves (" << cache.bytes() << " bytes)" << std::endl;
+    }
     std::cout << "Thank you for using c+++!" << std::endl;
-    return 0;
 }
+
+// Runs a journal recorded by the REPL (--record) at full speed with the
+// output discarded, checking the wave after every line against the
+// checksum recorded for it. Reports throughput; any mismatch fails.
+template <class Grub>
+int replay_session(Grub& wg, JournalReader& journal, const std::string& path) {
+    NullBuffer null;
+    std::ostream sink(&null);
+    wg.set_output(sink);
+    ReplayStats stats;
+    std::string line;
+    JournalRecord r;
+    auto start = std::chrono::steady_clock::now();
+    while (journal.next(r)) {
+        switch (r.kind) {
+            case 'S': wg.seed((unsigned)r.u64()); break;
+            case 'L':
+                line.assign(r.data, r.size);
+                wg.interpret(line);
+                ++stats.lines;
+                break;
+            case 'H': stats.check(r.u64(), wg.checksum()); break;
+        }
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    wg.set_output(std::cout);
+    return stats.report(std::cout, path, journal.truncated());
+}
+
+// Latencies in ns, bucketed log-linearly with 8 buckets per power of two,
+// so a percentile is within 12.5% of the true value at any scale and
+// recording one is a few instructions.
+class LatencyHistogram {
+private:
+    static const int SUB = 8;
+    uint64_t counts[64 * SUB];
+    uint64_t total, largest;
+
+    static int bucket(uint64_t ns) {
+        if (ns < SUB) return (int)ns;
+        int log = 63 - __builtin_clzll(ns);
+        return (log - 2) * SUB + (int)((ns >> (log - 3)) & (SUB - 1));
+    }
+
+    // Largest value that lands in bucket i
+    static uint64_t bucket_top(int i) {
+        if (i < SUB) return (uint64_t)i;
+        int log = i / SUB + 2;
+        uint64_t low = (uint64_t)(SUB + i % SUB) << (log - 3);
+        return low + ((uint64_t)1 << (log - 3)) - 1;
+    }
+
+public:
+    LatencyHistogram() { clear(); }
+
+    void clear() {
+        std::fill(counts, counts + 64 * SUB, 0);
+        total = largest = 0;
+    }
+
+    void add(uint64_t ns) {
+        ++counts[bucket(ns)];
+        ++total;
+        largest = std::max(largest, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < 64 * SUB; ++i) counts[i] += other.counts[i];
+        total += other.total;
+        largest = std::max(largest, other.largest);
+    }
+
+    uint64_t count() const { return total; }
+
+    // Upper bound of the q-quantile (0 < q <= 1), in ns
+    uint64_t percentile(double q) const {
+        uint64_t rank = (uint64_t)std::ceil(q * total), seen = 0;
+        for (int i = 0; i < 64 * SUB; ++i) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) return std::min(bucket_top(i), largest);
+        }
+        return largest;
+    }
+
+    // "N requests, p50 X us, p90 ..., p99 ..., max ..."
+    void write(std::ostream& os) const {
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision(1);
+        os << std::fixed << total << " requests, p50 " << percentile(0.5) / 1e3 << " us, p90 "
+           << percentile(0.9) / 1e3 << " us, p99 " << percentile(0.99) / 1e3 << " us, max " << largest / 1e3
+           << " us";
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+// Server mode: many c+++ sessions behind a Unix domain socket, one
+// WaveGrub per connection. Every message is a fixed header plus a payload,
+// little-endian. A client may send any number of requests without waiting;
+// a session answers them in order.
+//
+// Requests: ServerRequestHeader, then `length` bytes.
+//   'I'  interpret the payload as one c+++ line
+//   'S'  reseed N's generator with the payload's u32
+//   'T'  report this session's and the server's latency percentiles
+// flags: SERVER_SAMPLES appends the wave's samples to the response as raw
+// doubles, SERVER_TEXT appends what the line printed. Without SERVER_TEXT
+// the printing goes nowhere.
+//
+// Responses: ServerResponseHeader (status 0 for ok, 1 for an error whose
+// message is the text), the wave's parameters after the request, then
+// `samples` doubles and `text_bytes` of text.
+const uint8_t SERVER_SAMPLES = 1, SERVER_TEXT = 2;
+const uint32_t SERVER_MAX_REQUEST = 1 << 20;
+
+struct ServerRequestHeader {
+    uint32_t length;  // payload bytes after this header
+    uint32_t id;      // echoed in the response
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct ServerResponseHeader {
+    uint32_t length;  // bytes after this header: samples, then text
+    uint32_t id;
+    uint32_t text_bytes;
+    uint32_t samples;
+    uint8_t status;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t reserved2;
+    double amp, freq, phase;
+};
+
+static_assert(sizeof(ServerRequestHeader) == 12, "request header is 12 bytes");
+static_assert(sizeof(ServerResponseHeader) == 48, "response header is 48 bytes");
+
+struct ServerOptions {
+    std::string path;
+    unsigned threads = 0;  // workers; 0 for one per core
+    int samples = 256;
+    WaveEngine engine = WaveEngine::Kernel;
+    size_t wave_cache_bytes = 256 << 10;  // per session, so thousands of sessions stay small
+    Dispatch dispatch = Dispatch::Threaded;
+    bool quiet = false;  // no line per closed session
+};
+
+struct ServerRequest {
+    uint32_t id;
+    uint8_t kind, flags;
+    std::string payload;
+    std::chrono::steady_clock::time_point received;
+};
+
+// One connection. The event loop owns the socket and the byte buffers; a
+// worker owns the grub while `scheduled`, and the two hand requests and
+// responses over under `lock`.
+template <class Grub>
+struct ServerSession {
+    int fd;
+    uint64_t number;
+    Grub grub;
+    std::string in, out;  // event loop only
+    size_t out_sent;
+    uint32_t events;      // what epoll is watching for
+    bool read_closed, dead;
+    NullBuffer null;
+    std::ostream quiet;
+    std::ostringstream text;
+    LatencyHistogram latency;  // written by the worker while scheduled
+
+    std::mutex lock;
+    std::deque<ServerRequest> pending;
+    std::string ready;  // responses the event loop hasn't taken yet
+    bool scheduled;
+    size_t queued, queued_bytes;  // requests read but not yet answered in ready
+
+    ServerSession(int socket, uint64_t id, const ServerOptions& options) :
+        fd(socket), number(id), grub(options.samples), out_sent(0), events(0), read_closed(false), dead(false),
+        quiet(&null), scheduled(false), queued(0), queued_bytes(0) {
+        grub.set_engine(options.engine);
+        grub.set_wave_cache_budget(options.wave_cache_bytes);
+        grub.set_dispatch(options.dispatch);
+        grub.set_output(quiet);
+    }
+};
+
+template <class Grub>
+class InterpreterServer {
+private:
+    typedef ServerSession<Grub> Session;
+
+    const ServerOptions& options;
+    int listener, epoll_fd, wake_fd, signal_fd;
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions;
+    uint64_t next_session;
+    uint64_t sessions_served;
+
+    std::mutex lock;  // guards everything below
+    std::condition_variable work_ready;
+    std::deque<std::shared_ptr<Session>> runnable;
+    std::vector<std::shared_ptr<Session>> finished;  // have responses for the event loop
+    LatencyHistogram aggregate;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    static const uint64_t LISTENER = 0, WAKE = 1, SIGNALS = 2;
+    // A session stops being read while it holds this many bytes, unparsed,
+    // queued or unsent, or this many unanswered requests, whose responses
+    // may each be far larger than the request
+    static const size_t MAX_BACKLOG = 16 << 20;
+    static const size_t MAX_QUEUED = 4096;
+
+    // Reads while the session keeps up, writes while output is queued. A
+    // session waiting on nothing leaves the epoll set: a closed peer would
+    // otherwise report a hangup on every wait.
+    void update_events(Session& s) {
+        uint32_t events = 0;
+        if (!s.dead) {
+            if (!s.read_closed) {
+                size_t backlog = s.in.size() + s.out.size() - s.out_sent;
+                bool full;
+                {
+                    std::lock_guard<std::mutex> guard(s.lock);
+                    backlog += s.queued_bytes + s.ready.size();
+                    full = s.queued >= MAX_QUEUED;
+                }
+                if (!full && backlog < MAX_BACKLOG) events |= EPOLLIN | EPOLLRDHUP;
+            }
+            if (s.out_sent < s.out.size()) events |= EPOLLOUT;
+        }
+        if (events == s.events) return;
+        epoll_event e = {};
+        e.events = events;
+        e.data.u64 = s.number;
+        if (!events) ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s.fd, nullptr);
+        else ::epoll_ctl(epoll_fd, s.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s.fd, &e);
+        s.events = events;
+    }
+
+    // unmerged is this worker's batch so far, not yet in the aggregate
+    void serve(Session& s, const ServerRequest& r, std::string& out, const LatencyHistogram& unmerged) {
+        ServerResponseHeader h;
+        std::memset(&h, 0, sizeof(h));
+        h.id = r.id;
+        h.flags = r.flags & (SERVER_SAMPLES | SERVER_TEXT);
+        std::string message;
+        bool capture = (r.flags & SERVER_TEXT) != 0;
+        if (capture) {
+            s.text.str(std::string());
+            s.grub.set_output(s.text);
+        }
+        try {
+            switch (r.kind) {
+                case 'I': s.grub.interpret(r.payload); break;
+                case 'S': {
+                    uint32_t seed = 0;
+                    std::memcpy(&seed, r.payload.data(), std::min(r.payload.size(), sizeof(seed)));
+                    s.grub.seed(seed);
+                    break;
+                }
+                case 'T': {
+                    std::ostringstream report;
+                    report << "session " << s.number << ": ";
+                    s.latency.write(report);
+                    report << "\nserver: ";
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        LatencyHistogram total = aggregate;
+                        total.merge(unmerged);
+                        total.write(report);
+                    }
+                    report << '\n';
+                    message = report.str();
+                    capture = false;
+                    h.flags |= SERVER_TEXT;
+                    break;
+                }
+                default:
+                    h.status = 1;
+                    message = std::string("unknown request kind '") + (char)r.kind + "'";
+            }
+        } catch (const std::exception& e) {
+            h.status = 1;
+            message = e.what();
+        }
+        if (capture) {
+            message = s.text.str();
+            s.grub.set_output(s.quiet);
+        }
+        if (h.status) h.flags |= SERVER_TEXT;
+        WaveParams params = s.grub.wave_params();
+        h.amp = params.amp;
+        h.freq = params.freq;
+        h.phase = params.phase;
+        h.samples = (h.flags & SERVER_SAMPLES) ? s.grub.size() : 0;
+        h.text_bytes = (h.flags & SERVER_TEXT) ? (uint32_t)message.size() : 0;
+        h.length = h.samples * sizeof(double) + h.text_bytes;
+        out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+        if (h.samples) out.append(reinterpret_cast<const char*>(s.grub.samples()), h.samples * sizeof(double));
+        out.append(message.data(), h.text_bytes);
+    }
+
+    // Marks s as having no one to answer to and drops what it had queued;
+    // a batch already running finishes, but nothing more is started for it.
+    void abandon(Session& s) {
+        s.dead = true;
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.queued -= s.pending.size();
+        for (const ServerRequest& r : s.pending) s.queued_bytes -= sizeof(r) + r.payload.size();
+        s.pending.clear();
+    }
+
+    // Runs everything a session had queued, hands the responses to the
+    // event loop, and requeues the session if more arrived meanwhile. Once
+    // the server is stopping, queued sessions are left as they are.
+    void work() {
+        std::deque<ServerRequest> batch;
+        std::string out;
+        LatencyHistogram batch_latency;
+        while (true) {
+            std::shared_ptr<Session> s;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                work_ready.wait(guard, [&] { return stopping || !runnable.empty(); });
+                if (stopping) return;
+                s = std::move(runnable.front());
+                runnable.pop_front();
+            }
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+                batch.swap(s->pending);
+            }
+            out.clear();
+            batch_latency.clear();
+            for (const ServerRequest& r : batch) {
+                serve(*s, r, out, batch_latency);
+                uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - r.received).count();
+                s->latency.add(ns);
+                batch_latency.add(ns);
+            }
+            bool again;
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+                s->ready += out;
+                s->queued -= batch.size();
+                for (const ServerRequest& r : batch) s->queued_bytes -= sizeof(r) + r.payload.size();
+                again = !s->pending.empty();
+                if (!again) s->scheduled = false;
+            }
+            batch.clear();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                aggregate.merge(batch_latency);
+                finished.push_back(s);
+                if (again) runnable.push_back(s);
+            }
+            if (again) work_ready.notify_one();
+            uint64_t one = 1;
+            if (::write(wake_fd, &one, sizeof(one)) < 0) {}  // a full counter still wakes the loop
+        }
+    }
+
+    void accept_all() {
+        while (true) {
+            int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            uint64_t number = next_session++;
+            std::shared_ptr<Session> s = std::make_shared<Session>(fd, number, options);
+            sessions.emplace(number, s);
+            update_events(*s);
+        }
+    }
+
+    // Splits s.in into requests. Returns false on a malformed frame.
+    bool parse(Session& s, std::deque<ServerRequest>& parsed) {
+        size_t at = 0;
+        auto now = std::chrono::steady_clock::now();
+        while (s.in.size() - at >= sizeof(ServerRequestHeader)) {
+            ServerRequestHeader h;
+            std::memcpy(&h, s.in.data() + at, sizeof(h));
+            if (h.length > SERVER_MAX_REQUEST) return false;
+            if (s.in.size() - at - sizeof(h) < h.length) break;
+            ServerRequest r;
+            r.id = h.id;
+            r.kind = h.kind;
+            r.flags = h.flags;
+            r.payload.assign(s.in.data() + at + sizeof(h), h.length);
+            r.received = now;
+            parsed.push_back(std::move(r));
+            at += sizeof(h) + h.length;
+        }
+        s.in.erase(0, at);
+        return true;
+    }
+
+    // Reads one buffer at most, so the backlog is checked again before more
+    // is taken; level-triggered epoll reports whatever is left.
+    void read_from(const std::shared_ptr<Session>& s) {
+        char buffer[64 << 10];
+        ssize_t k;
+        do {
+            k = ::read(s->fd, buffer, sizeof(buffer));
+        } while (k < 0 && errno == EINTR);
+        if (k > 0) s->in.append(buffer, k);
+        else if (k == 0) s->read_closed = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK) abandon(*s);
+        std::deque<ServerRequest> parsed;
+        if (!s->dead && !parse(*s, parsed)) abandon(*s);
+        if (!parsed.empty() && !s->dead) {
+            bool schedule;
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+                for (ServerRequest& r : parsed) {
+                    ++s->queued;
+                    s->queued_bytes += sizeof(r) + r.payload.size();
+                    s->pending.push_back(std::move(r));
+                }
+                schedule = !s->scheduled;
+                s->scheduled = true;
+            }
+            if (schedule) {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    runnable.push_back(s);
+                }
+                work_ready.notify_one();
+            }
+        }
+    }
+
+    void write_to(Session& s) {
+        while (s.out_sent < s.out.size()) {
+            ssize_t k = ::send(s.fd, s.out.data() + s.out_sent, s.out.size() - s.out_sent, MSG_NOSIGNAL);
+            if (k > 0) {
+                s.out_sent += k;
+                continue;
+            }
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            abandon(s);
+            break;
+        }
+        if (s.out_sent == s.out.size()) {
+            s.out.clear();
+            s.out_sent = 0;
+        }
+    }
+
+    // Closes s once its peer is gone and nothing is left to run or send
+    void maybe_close(const std::shared_ptr<Session>& s) {
+        if (!s->dead && !s->read_closed) return;
+        {
+            std::lock_guard<std::mutex> guard(s->lock);
+            if (s->scheduled || !s->pending.empty() || !s->ready.empty()) return;
+        }
+        if (!s->dead && s->out_sent < s->out.size()) return;
+        if (s->events) ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, nullptr);
+        ::close(s->fd);
+        ++sessions_served;
+        if (!options.quiet && s->latency.count() > 0) {
+            std::ostringstream line;
+            line << "session " << s->number << ": ";
+            s->latency.write(line);
+            std::cerr << line.str() << std::endl;
+        }
+        sessions.erase(s->number);
+    }
+
+    void collect_responses() {
+        uint64_t count;
+        if (::read(wake_fd, &count, sizeof(count)) < 0) {}
+        std::vector<std::shared_ptr<Session>> done;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done.swap(finished);
+        }
+        for (const std::shared_ptr<Session>& s : done) {
+            if (sessions.find(s->number) == sessions.end()) continue;
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+                if (s->out.empty()) s->out.swap(s->ready);
+                else s->out += s->ready;
+                s->ready.clear();
+            }
+            if (!s->dead) write_to(*s);
+            update_events(*s);
+            maybe_close(s);
+        }
+    }
+
+public:
+    explicit InterpreterServer(const ServerOptions& o) :
+        options(o), listener(-1), epoll_fd(-1), wake_fd(-1), signal_fd(-1), next_session(3), sessions_served(0),
+        stopping(false) {}
+
+    ~InterpreterServer() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (std::thread& w : workers) w.join();
+        for (auto& entry : sessions) ::close(entry.second->fd);
+        if (listener >= 0) {
+            ::close(listener);
+            ::unlink(options.path.c_str());
+        }
+        if (epoll_fd >= 0) ::close(epoll_fd);
+        if (wake_fd >= 0) ::close(wake_fd);
+        if (signal_fd >= 0) ::close(signal_fd);
+    }
+
+    InterpreterServer(const InterpreterServer&) = delete;
+    InterpreterServer& operator=(const InterpreterServer&) = delete;
+
+    // Serves until SIGINT or SIGTERM, then reports the totals
+    int run() {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (options.path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << options.path << std::endl;
+            return 1;
+        }
+        std::strcpy(address.sun_path, options.path.c_str());
+        listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ::unlink(options.path.c_str());  // a socket left by a server that died
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "Cannot listen on " << options.path << ": " << std::strerror(errno) << std::endl;
+            if (listener >= 0) ::close(listener);
+            listener = -1;
+            return 1;
+        }
+
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);  // workers inherit the mask
+        signal_fd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (signal_fd < 0 || wake_fd < 0 || epoll_fd < 0) {
+            std::cerr << "Cannot set up the event loop: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        const std::pair<int, uint64_t> fixed[] = {{listener, LISTENER}, {wake_fd, WAKE}, {signal_fd, SIGNALS}};
+        for (const auto& f : fixed) {
+            epoll_event e = {};
+            e.events = EPOLLIN;
+            e.data.u64 = f.second;
+            ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, f.first, &e);
+        }
+
+        unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back(&InterpreterServer::work, this);
+        std::cerr << "Serving c+++ on " << options.path << " with " << threads << " workers" << std::endl;
+
+        auto start = std::chrono::steady_clock::now();
+        epoll_event events[256];
+        bool running = true;
+        while (running) {
+            int ready = ::epoll_wait(epoll_fd, events, 256, -1);
+            if (ready < 0 && errno != EINTR) break;
+            for (int i = 0; i < ready; ++i) {
+                uint64_t tag = events[i].data.u64;
+                if (tag == LISTENER) {
+                    accept_all();
+                } else if (tag == WAKE) {
+                    collect_responses();
+                } else if (tag == SIGNALS) {
+                    running = false;
+                } else {
+                    auto it = sessions.find(tag);
+                    if (it == sessions.end()) continue;
+                    std::shared_ptr<Session> s = it->second;
+                    // Requests that arrived before the peer stopped writing
+                    // still run. A hangup or error means it is gone
+                    // altogether, so nothing more is worth running.
+                    uint32_t happened = events[i].events;
+                    if ((s->events & EPOLLIN) && (happened & (EPOLLIN | EPOLLRDHUP))) read_from(s);
+                    if (happened & (EPOLLHUP | EPOLLERR)) abandon(*s);
+                    if (!s->dead && (events[i].events & EPOLLOUT)) write_to(*s);
+                    update_events(*s);
+                    maybe_close(s);
+                }
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::ostringstream summary;
+        summary << "Served " << sessions_served + sessions.size() << " sessions in " << seconds << " s: ";
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            aggregate.write(summary);
+            summary << " (" << aggregate.count() / seconds << " requests/sec)";
+        }
+        std::cerr << summary.str() << std::endl;
+        return 0;
+    }
+};
+
+template <class Grub>
+int run_server(const ServerOptions& options) {
+    InterpreterServer<Grub> server(options);
+    return server.run();
+}
+
+struct LoadOptions {
+    std::string path;
+    int connections = 4;
+    uint64_t requests = 100000;  // per connection
+    int pipeline = 16;           // requests in flight per connection
+    std::string program = "A";
+    uint8_t flags = 0;
+};
+
+// Drives a server (--connect) with `connections` clients, each keeping
+// `pipeline` requests in flight, and reports throughput and the latency
+// the clients saw.
+int run_load(const LoadOptions& options) {
+    std::vector<LatencyHistogram> latency(options.connections);
+    std::atomic<uint64_t> errors(0);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < options.connections; ++c) {
+        clients.emplace_back([&, c] {
+            int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, options.path.c_str(), sizeof(address.sun_path) - 1);
+            if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                errors.fetch_add(options.requests);
+                if (fd >= 0) ::close(fd);
+                return;
+            }
+            std::vector<std::chrono::steady_clock::time_point> sent_at(options.pipeline);
+            std::string batch, in;
+            char buffer[64 << 10];
+            uint64_t sent = 0, received = 0;
+            while (received < options.requests) {
+                batch.clear();
+                auto now = std::chrono::steady_clock::now();
+                for (; sent < options.requests && sent - received < (uint64_t)options.pipeline; ++sent) {
+                    ServerRequestHeader h = {(uint32_t)options.program.size(), (uint32_t)sent, 'I', options.flags, 0};
+                    batch.append(reinterpret_cast<const char*>(&h), sizeof(h));
+                    batch += options.program;
+                    sent_at[sent % options.pipeline] = now;
+                }
+                for (size_t at = 0; at < batch.size();) {
+                    ssize_t k = ::send(fd, batch.data() + at, batch.size() - at, MSG_NOSIGNAL);
+                    if (k <= 0 && errno != EINTR) {
+                        errors.fetch_add(options.requests - received);
+                        ::close(fd);
+                        return;
+                    }
+                    if (k > 0) at += k;
+                }
+                ssize_t k = ::read(fd, buffer, sizeof(buffer));
+                if (k <= 0) {
+                    if (k < 0 && errno == EINTR) continue;
+                    errors.fetch_add(options.requests - received);
+                    ::close(fd);
+                    return;
+                }
+                in.append(buffer, k);
+                size_t at = 0;
+                auto arrived = std::chrono::steady_clock::now();
+                while (in.size() - at >= sizeof(ServerResponseHeader)) {
+                    ServerResponseHeader h;
+                    std::memcpy(&h, in.data() + at, sizeof(h));
+                    if (in.size() - at - sizeof(h) < h.length) break;
+                    if (h.status != 0 || h.id != (uint32_t)received) errors.fetch_add(1);
+                    latency[c].add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        arrived - sent_at[received % options.pipeline]).count());
+                    ++received;
+                    at += sizeof(h) + h.length;
+                }
+                in.erase(0, at);
+            }
+            ::close(fd);
+        });
+    }
+    for (std::thread& t : clients) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LatencyHistogram total;
+    for (const LatencyHistogram& h : latency) total.merge(h);
+    std::cout << options.connections << " connections, pipeline " << options.pipeline << ": ";
+    total.write(std::cout);
+    std::cout << " in " << seconds << " s (" << total.count() / seconds << " requests/sec)";
+    if (errors) std::cout << ", " << errors << " failed";
+    std::cout << std::endl;
+    return errors ? 1 : 0;
+}
+
+// Parses the whole number after an option's '=' into value, which must lie
+// in [min, max]. Prints why and returns false otherwise.
+bool parse_option(const std::string& arg, size_t prefix, long long min, long long max, long long& value) {
+    const char* text = arg.c_str() + prefix;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0) {
+        std::cerr << "Not a number: " << arg << std::endl;
+        return false;
+    }
+    if (value < min || value > max) {
+        std::cerr << arg.substr(0, prefix - 1) << " must be in " << min << ".." << max << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The same for a real number, which must be finite and in [min, max]
+bool parse_option(const std::string& arg, size_t prefix, double min, double max, double& value) {
+    const char* text = arg.c_str() + prefix;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtod(text, &end);
+    if (end == text || *end != '\0' || errno != 0 || !std::isfinite(value)) {
+        std::cerr << "Not a number: " << arg << std::endl;
+        return false;
+    }
+    if (value < min || value > max) {
+        std::streamsize precision = std::cerr.precision(10);
+        std::cerr << arg.substr(0, prefix - 1) << " must be in " << min << ".." << max << std::endl;
+        std::cerr.precision(precision);
+        return false;
+    }
+    return true;
+}
+
+#ifndef WAVEGRUB_NO_MAIN
+int main(int argc, char* argv[]) {
+    WaveEngine engine = WaveEngine::Kernel;
+    int samples = 256;
+    std::string batch;
+    BatchOptions batch_options;
+    size_t wave_cache_bytes = batch_options.wave_cache_bytes;
+    Dispatch dispatch = Dispatch::Threaded;
+    bool cache_stats = false;
+    bool profile = false;
+    std::string profile_folded;
+    bool streaming = false;
+    std::string stream_format;
+    StreamOptions stream_options;
+    bool size_given = false;
+    std::string ref_path, dump_path, dump_format = "f64";
+    size_t ref_index = 0;
+    bool engine_given = false;
+    std::string record_path, replay_path;
+    ServerOptions server_options;
+    LoadOptions load_options;
+    bool wave_cache_given = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--check-sine") return check_sine();
+        if (arg == "--check-recurrence") return check_recurrence();
+        if (arg == "--bench-sizes") return bench_sizes();
+        if (arg == "--check-dispatch") return check_dispatch();
+        if (arg == "--check-fixed") return check_fixed();
+        if (arg == "--dispatch=switch") dispatch = Dispatch::Switch;
+        if (arg == "--dispatch=threaded") dispatch = Dispatch::Threaded;
+        if (arg.compare(0, 8, "--batch=") == 0) batch = arg.substr(8);
+        if (arg.compare(0, 10, "--threads=") == 0) {
+            long long value;
+            if (!parse_option(arg, 10, 1, 4096, value)) return 1;
+            batch_options.threads = (unsigned)value;
+        }
+        if (arg.compare(0, 7, "--seed=") == 0) {
+            long long value;
+            if (!parse_option(arg, 7, 0, std::numeric_limits<unsigned>::max(), value)) return 1;
+            batch_options.seed = (unsigned)value;
+        }
+        if (arg.compare(0, 13, "--wave-cache=") == 0) {
+            double mib;  // 0 turns the cache off
+            if (!parse_option(arg, 13, 0.0, 1 << 20, mib)) return 1;
+            wave_cache_bytes = (size_t)(mib * (1 << 20));
+            wave_cache_given = true;
+        }
+        if (arg == "--cache-stats") cache_stats = true;
+        if (arg == "--profile") profile = true;
+        if (arg.compare(0, 17, "--profile-folded=") == 0) profile_folded = arg.substr(17);
+        if (arg.compare(0, 9, "--stream=") == 0) {
+            streaming = true;
+            stream_options.path = arg.substr(9);
+        }
+        if (arg.compare(0, 16, "--stream-format=") == 0) stream_format = arg.substr(16);
+        if (arg.compare(0, 7, "--rate=") == 0) stream_options.rate = std::atof(arg.c_str() + 7);
+        if (arg.compare(0, 8, "--block=") == 0) stream_options.block = std::atoi(arg.c_str() + 8);
+        if (arg.compare(0, 7, "--ramp=") == 0) stream_options.ramp = std::atoi(arg.c_str() + 7);
+        if (arg.compare(0, 10, "--base-hz=") == 0) stream_options.base_hz = std::atof(arg.c_str() + 10);
+        if (arg == "--realtime") stream_options.realtime = true;
+        if (arg.compare(0, 7, "--hold=") == 0) stream_options.hold = std::atoi(arg.c_str() + 7);
+        if (arg.compare(0, 11, "--duration=") == 0) stream_options.duration = std::atof(arg.c_str() + 11);
+        if (arg.compare(0, 6, "--ref=") == 0) ref_path = arg.substr(6);
+        if (arg.compare(0, 12, "--ref-index=") == 0) ref_index = std::strtoull(arg.c_str() + 12, nullptr, 10);
+        if (arg.compare(0, 7, "--dump=") == 0) dump_path = arg.substr(7);
+        if (arg.compare(0, 14, "--dump-format=") == 0) dump_format = arg.substr(14);
+        if (arg.compare(0, 9, "--record=") == 0) record_path = arg.substr(9);
+        if (arg.compare(0, 9, "--replay=") == 0) replay_path = arg.substr(9);
+        if (arg.compare(0, 8, "--serve=") == 0) server_options.path = arg.substr(8);
+        if (arg == "--quiet") server_options.quiet = true;
+        if (arg.compare(0, 10, "--connect=") == 0) load_options.path = arg.substr(10);
+        if (arg.compare(0, 14, "--connections=") == 0) {
+            long long value;
+            if (!parse_option(arg, 14, 1, 65536, value)) return 1;
+            load_options.connections = (int)value;
+        }
+        if (arg.compare(0, 11, "--requests=") == 0) {
+            long long value;
+            if (!parse_option(arg, 11, 1, std::numeric_limits<long long>::max(), value)) return 1;
+            load_options.requests = (uint64_t)value;
+        }
+        if (arg.compare(0, 11, "--pipeline=") == 0) {
+            long long value;
+            if (!parse_option(arg, 11, 1, 65536, value)) return 1;
+            load_options.pipeline = (int)value;
+        }
+        if (arg.compare(0, 10, "--program=") == 0) load_options.program = arg.substr(10);
+        if (arg == "--load-samples") load_options.flags |= SERVER_SAMPLES;
+        if (arg == "--load-text") load_options.flags |= SERVER_TEXT;
+        if (arg.compare(0, 9, "--engine=") == 0) {
+            engine_given = true;
+            if (!parse_wave_engine(arg.substr(9), engine)) {
+                std::cerr << "Unknown engine: " << arg.substr(9)
+                          << " (expected kernel, libm or recurrence)" << std::endl;
+                return 1;
+            }
+        }
+        if (arg.compare(0, 7, "--size=") == 0) {
+            samples = std::atoi(arg.c_str() + 7);
+            size_given = true;
+            if (samples < 1) {
+                std::cerr << "Wave size must be positive" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    if (streaming) {
+        const std::string& path = stream_options.path;
+        bool wav_name = path.size() > 4 && path.compare(path.size() - 4, 4, ".wav") == 0;
+        if (stream_format == "wav" || (stream_format.empty() && wav_name)) {
+            stream_options.format = BlockWriter::Wav;
+        } else if (!stream_format.empty() && stream_format != "raw") {
+            std::cerr << "Unknown stream format: " << stream_format << " (expected raw or wav)" << std::endl;
+            return 1;
+        }
+        if (stream_options.rate <= 0 || stream_options.block < 1 || stream_options.block > 65536 ||
+            stream_options.ramp < 0 || stream_options.hold < 1) {
+            std::cerr << "Stream needs --rate > 0, --block in 1..65536, --ramp >= 0 and --hold >= 1" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!load_options.path.empty()) return run_load(load_options);
+
+    if (!server_options.path.empty()) {
+        server_options.threads = batch_options.threads;
+        server_options.samples = samples;
+        server_options.engine = engine;
+        server_options.dispatch = dispatch;
+        if (wave_cache_given) server_options.wave_cache_bytes = wave_cache_bytes;
+        return samples == 256 ? run_server<WaveGrub<256>>(server_options) : run_server<WaveGrub<0>>(server_options);
+    }
+
+    // A replay takes the recorded size, engine and reference wave unless
+    // told otherwise; another --engine is a way to compare engines on a real
+    // session, but another --ref or --size is refused.
+    std::unique_ptr<JournalReader> replay;
+    if (!replay_path.empty()) {
+        if (!batch.empty() || streaming || !record_path.empty()) {
+            std::cerr << "--replay runs on its own, without --batch, --stream or --record" << std::endl;
+            return 1;
+        }
+        try {
+            replay.reset(new JournalReader(replay_path, "c"));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        JournalRecord r;
+        std::string recorded_ref;
+        while (replay->next(r) && r.kind == 'O') {
+            std::string option = r.text();
+            if (option.compare(0, 5, "size=") == 0) {
+                int recorded = std::atoi(option.c_str() + 5);
+                if (size_given && recorded != samples) {
+                    std::cerr << replay_path << " was recorded with --size=" << recorded << std::endl;
+                    return 1;
+                }
+                samples = recorded;
+                size_given = true;
+            } else if (option.compare(0, 7, "engine=") == 0 && !engine_given) {
+                parse_wave_engine(option.substr(7), engine);
+            } else if (option.compare(0, 4, "ref=") == 0) {
+                recorded_ref = option.substr(4);
+            }
+        }
+        replay->rewind();
+        std::string given_ref = ref_path.empty() ? "" : ref_path + "#" + std::to_string(ref_index);
+        if (given_ref != recorded_ref) {
+            size_t hash = recorded_ref.rfind('#');
+            if (ref_path.empty()) {
+                ref_path = recorded_ref.substr(0, hash);
+                ref_index = std::strtoull(recorded_ref.c_str() + hash + 1, nullptr, 10);
+            } else {
+                std::cerr << replay_path << " was recorded ";
+                if (recorded_ref.empty()) std::cerr << "against the built-in reference wave" << std::endl;
+                else std::cerr << "with --ref=" << recorded_ref.substr(0, hash)
+                               << " --ref-index=" << recorded_ref.substr(hash + 1) << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::shared_ptr<const SampleTables> reference;
+    if (!ref_path.empty()) {
+        try {
+            reference = reference_tables(ref_path, ref_index);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        int ref_samples = (int)reference->t.size();
+        if (size_given && samples != ref_samples) {
+            std::cerr << ref_path << " holds " << ref_samples << "-sample waves, not " << samples << std::endl;
+            return 1;
+        }
+        samples = ref_samples;
+    }
+
+    std::unique_ptr<WaveFileWriter> dump;
+    if (!dump_path.empty()) {
+        if (dump_format != "f32" && dump_format != "f64") {
+            std::cerr << "Unknown dump format: " << dump_format << " (expected f32 or f64)" << std::endl;
+            return 1;
+        }
+        if (!batch.empty()) {
+            std::cerr << "--dump works with the REPL and --stream, not --batch" << std::endl;
+            return 1;
+        }
+        if (dump_path == "-" && (!streaming || stream_options.path == "-")) {
+            std::cerr << "--dump=- needs --stream to a file; stdout already carries the REPL or the stream" << std::endl;
+            return 1;
+        }
+        try {
+            dump.reset(new WaveFileWriter(dump_path, dump_format == "f32" ? WaveDType::Float32 : WaveDType::Float64,
+                                          samples, streaming ? stream_options.rate : 0, true));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // The REPL's seed is recorded so N draws the same waves on replay
+    std::unique_ptr<JournalWriter> journal;
+    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+    if (!record_path.empty()) {
+        if (!batch.empty() || streaming) {
+            std::cerr << "--record works with the REPL, not --batch or --stream" << std::endl;
+            return 1;
+        }
+        try {
+            journal.reset(new JournalWriter(record_path, "c"));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        journal->text('O', "size=" + std::to_string(samples));
+        journal->text('O', std::string("engine=") + wave_engine_name(engine));
+        if (!ref_path.empty()) journal->text('O', "ref=" + ref_path + "#" + std::to_string(ref_index));
+        journal->u64('S', seed);
+    }
+
+    Profiler profiler;
+    Profiler* active = nullptr;
+    if (profile || !profile_folded.empty()) {
+#if WAVEGRUB_PROFILE
+        active = &profiler;
+#else
+        std::cerr << "Profiling was compiled out (WAVEGRUB_PROFILE=0)" << std::endl;
+        return 1;
+#endif
+    }
+
+    if (!batch.empty()) {
+        batch_options.samples = samples;
+        batch_options.engine = engine;
+        batch_options.wave_cache_bytes = wave_cache_bytes;
+        batch_options.dispatch = dispatch;
+        batch_options.profiler = active;
+        batch_options.reference = reference;
+        int status = run_batch(batch, batch_options);
+        if (active && status == 0) status = write_profile(profiler, profile, profile_folded, "program");
+        return status;
+    }
+
+    int status = 0;
+    if (samples == 256) {
+        WaveGrub<256> wg;
+        wg.set_engine(engine);
+        wg.set_wave_cache_budget(wave_cache_bytes);
+        wg.set_dispatch(dispatch);
+        wg.set_profiler(active);
+        if (reference) wg.set_reference(reference);
+        wg.set_dump(dump.get());
+        if (journal) wg.seed(seed);
+        if (replay) status = replay_session(wg, *replay, replay_path);
+        else if (streaming) status = run_stream(wg, stream_options);
+        else run_repl(wg, cache_stats, journal.get());
+    } else {
+        WaveGrub<0> wg(samples);
+        wg.set_engine(engine);
+        wg.set_wave_cache_budget(wave_cache_bytes);
+        wg.set_dispatch(dispatch);
+        wg.set_profiler(active);
+        if (reference) wg.set_reference(reference);
+        wg.set_dump(dump.get());
+        if (journal) wg.seed(seed);
+        if (replay) status = replay_session(wg, *replay, replay_path);
+        else if (streaming) status = run_stream(wg, stream_options);
+        else run_repl(wg, cache_stats, journal.get());
+    }
+    if (journal && !journal->ok()) {
+        std::cerr << "Cannot write " << record_path << std::endl;
+        status = 1;
+    }
+    if (dump && !dump->close()) {
+        std::cerr << "Cannot write " << dump_path << std::endl;
+        status = 1;
+    }
+    if (active && status == 0) status = write_profile(profiler, profile, profile_folded, "line");
+    return status;
+}
+#endif
@@ -7,6 +7,8 @@
 #include <random>
 #include <chrono>
 #include <sstream>
+#include <cstring>
+#include "wave_kernels.h"
 
 class WaveGrub {
 private:
@@ -45,15 +47,11 @@ public:
         target_freq = dist(generator);
         target_phase = dist(generator) * M_PI;
 
-        for (int i = 0; i < SIZE; ++i) {
-            target_wave[i] = target_amp * std::sin(target_freq * t[i] + target_phase);
-        }
+        sine_wave(target_wave.data(), t.data(), SIZE, target_amp, target_freq, target_phase);
     }
 
     void update_wave() {
-        for (int i = 0; i < SIZE; ++i) {
-            wave[i] = amp * std::sin(freq * t[i] + phase);
-        }
+        sine_wave(wave.data(), t.data(), SIZE, amp, freq, phase);
     }
 
     void interpret(const std::string& code) {
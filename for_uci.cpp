@@ -7,15 +7,483 @@
 #include <random>
 #include <chrono>
 #include <sstream>
+#include <atomic>
+#include <limits>
+#include <complex>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include "wave_kernels.h"
+#include "thread_pool.h"
+#include "telemetry.h"
+#include "mapped_file.h"
+#include "wave_file.h"
+#include "journal.h"
 
+enum class SolverMode { Serial, Parallel, LeastSquares, LevenbergMarquardt };
+
+// Parameter box shared by the game controls and every solver.
+struct FitBounds {
+    double amp_min = 0.1, amp_max = 2.0;
+    double freq_min = 0.1, freq_max = 2.0;
+};
+
+struct FitResult {
+    double amp, freq, phase;
+    double error;      // RMS over the samples, as calculate_error() reports it
+    int iterations;    // objective evaluations or solver steps
+    double micros;
+};
+
+// One progress sample from the serial sweep, as queued for telemetry and
+// stored in the binary log.
+struct SweepRecord {
+    uint64_t iteration;
+    double amp, freq, phase, error;
+    double best_amp, best_freq, best_phase, best_error;
+};
+
+// Shared between a solve running in the background and the REPL. The
+// solver counts the candidates it has scored and offers each improvement;
+// the REPL reads snapshots and can ask it to stop early, in which case the
+// solve returns the best candidate seen so far.
+class SolveProgress {
+private:
+    mutable std::mutex lock;
+    FitResult best;
+
+public:
+    std::atomic<bool> cancel;
+    std::atomic<size_t> evaluated, total;
+
+    SolveProgress() : cancel(false), evaluated(0), total(0) {
+        best.error = std::numeric_limits<double>::infinity();
+    }
+
+    bool cancelled() const { return cancel.load(std::memory_order_relaxed); }
+
+    void offer(double error, double amp, double freq, double phase) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (error < best.error) {
+            best.amp = amp;
+            best.freq = freq;
+            best.phase = phase;
+            best.error = error;
+        }
+    }
+
+    FitResult snapshot() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return best;
+    }
+};
+
+// In-place radix-2 FFT; n must be a power of two.
+inline void fft(std::vector<std::complex<double>>& a) {
+    size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        std::complex<double> w_len = std::polar(1.0, -2 * M_PI / len);
+        for (size_t i = 0; i < n; i += len) {
+            std::complex<double> w = 1;
+            for (size_t k = 0; k < len / 2; ++k) {
+                std::complex<double> u = a[i + k], v = a[i + k + len / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+                w *= w_len;
+            }
+        }
+    }
+}
+
+// Coarse frequency in cycles per window: the strongest spectral peak inside
+// the bounds, refined by a parabola through its neighbours. n a power of two
+// takes one FFT; otherwise a direct DFT of the candidate bins when there
+// are few of them, or an FFT of y zero-padded to a power of two.
+inline double estimate_frequency(const double* y, int n, const FitBounds& bounds) {
+    int lo = std::max(0, (int)std::floor(bounds.freq_min));
+    int hi = std::min(n / 2, (int)std::ceil(bounds.freq_max) + 1);
+    int size = n;           // transform length
+    double bin_freq = 1.0;  // cycles per window in one bin
+    if ((n & (n - 1)) != 0 && hi > 64) {
+        size = 1;
+        while (size < 2 * n) size <<= 1;
+        bin_freq = (double)n / size;
+        lo = (int)std::floor(lo / bin_freq);
+        hi = std::min(size / 2, (int)std::ceil(hi / bin_freq));
+    }
+    std::vector<double> mag(hi + 2, 0.0);
+    if ((size & (size - 1)) == 0) {
+        std::vector<std::complex<double>> spectrum(size);
+        std::copy(y, y + n, spectrum.begin());
+        fft(spectrum);
+        for (int k = 0; k <= hi + 1 && k <= size / 2; ++k) mag[k] = std::abs(spectrum[k]);
+    } else {
+        for (int k = 0; k <= hi + 1 && k <= n / 2; ++k) {
+            std::complex<double> sum = 0;
+            for (int i = 0; i < n; ++i) sum += y[i] * std::polar(1.0, -2 * M_PI * k * i / n);
+            mag[k] = std::abs(sum);
+        }
+    }
+    int peak = lo;
+    for (int k = lo; k <= hi; ++k) if (mag[k] > mag[peak]) peak = k;
+    double f = peak;
+    if (peak > 0) {
+        double l = mag[peak - 1], c = mag[peak], r = mag[peak + 1];
+        double denom = l - 2 * c + r;
+        if (denom != 0) f += 0.5 * (l - r) / denom;
+    }
+    return std::min(std::max(f * bin_freq, bounds.freq_min), bounds.freq_max);
+}
+
+// With the frequency fixed, amp*sin(f*t + phase) = a*sin(f*t) + b*cos(f*t)
+// is linear in (a, b), so the best amp and phase come from 2x2 normal
+// equations. Returns the residual sum of squares of the fitted model.
+struct SeparableFit {
+    const double* t;
+    const double* y;
+    int n;
+    FitBounds bounds;
+    std::vector<double> s, c;
+
+    SeparableFit(const double* t_, const double* y_, int n_, const FitBounds& b)
+        : t(t_), y(y_), n(n_), bounds(b), s(n_), c(n_) {}
+
+    // Best (a, b) with |(a, b)| = radius when the unconstrained optimum lies
+    // off that circle. Unless the frequency is a whole number of cycles the
+    // Gram matrix G is not a multiple of the identity, so scaling the
+    // optimum onto the circle is not the answer. The answer solves
+    // (G + lambda*I) x = (sy, cy) for the lambda > -min eigenvalue of G
+    // where |x| = radius, and |x| falls monotonically in lambda, so
+    // bisection finds it. When no such lambda exists (the "hard case"), (a, b)
+    // is scaled onto the circle instead.
+    static void on_circle(double ss, double sc, double cc, double sy, double cy, double radius,
+                          double& a, double& b) {
+        auto norm = [&](double lambda, double& x, double& z) {
+            double d = (ss + lambda) * (cc + lambda) - sc * sc;
+            x = ((cc + lambda) * sy - sc * cy) / d;
+            z = ((ss + lambda) * cy - sc * sy) / d;
+            return std::hypot(x, z);
+        };
+        double x, z;
+        double lo, hi;
+        if (radius < std::hypot(a, b)) {
+            lo = 0;
+            hi = std::max(ss, cc);
+            while (norm(hi, x, z) > radius && hi < 1e300) hi *= 2;
+        } else {
+            double l_min = (ss + cc) / 2 - std::hypot((ss - cc) / 2, sc);
+            lo = -l_min * (1 - 1e-12);
+            hi = 0;
+            if (!(norm(lo, x, z) >= radius)) {
+                double r = std::hypot(a, b);
+                a = r > 0 ? a * radius / r : radius;
+                b = r > 0 ? b * radius / r : 0;
+                return;
+            }
+        }
+        for (int i = 0; i < 200 && lo < hi; ++i) {
+            double mid = lo + (hi - lo) / 2;
+            if (mid <= lo || mid >= hi) break;
+            if (norm(mid, x, z) > radius) lo = mid;
+            else hi = mid;
+        }
+        norm(hi, x, z);
+        double r = std::hypot(x, z);
+        a = x * radius / r;  // exactly on the circle despite rounding
+        b = z * radius / r;
+    }
+
+    double solve(double f, double& amp, double& phase) {
+        sine_wave(s.data(), t, n, 1.0, f, 0.0);
+        sine_wave(c.data(), t, n, 1.0, f, M_PI / 2);
+        double ss = 0, sc = 0, cc = 0, sy = 0, cy = 0;
+        for (int i = 0; i < n; ++i) {
+            ss += s[i] * s[i];
+            sc += s[i] * c[i];
+            cc += c[i] * c[i];
+            sy += s[i] * y[i];
+            cy += c[i] * y[i];
+        }
+        double det = ss * cc - sc * sc;
+        double a = 0, b = 0;
+        bool full_rank = std::fabs(det) > 1e-12 * ss * cc;
+        if (full_rank) {
+            a = (sy * cc - cy * sc) / det;
+            b = (cy * ss - sy * sc) / det;
+        } else if (ss > 0) {
+            a = sy / ss;
+        }
+        double r = std::hypot(a, b);
+        amp = std::min(std::max(r, bounds.amp_min), bounds.amp_max);
+        if (full_rank && amp != r) on_circle(ss, sc, cc, sy, cy, amp, a, b);
+        phase = std::atan2(b, a);
+        if (phase < 0) phase += 2 * M_PI;
+        double ca = amp * std::cos(phase), cb = amp * std::sin(phase);
+        double rss = 0;
+        for (int i = 0; i < n; ++i) {
+            double r = ca * s[i] + cb * c[i] - y[i];
+            rss += r * r;
+        }
+        return rss;
+    }
+};
+
+// Separable least squares: FFT estimate, a 0.05-step scan within one bin of
+// it, then golden-section search around the best scan point.
+inline FitResult fit_least_squares(const double* t, const double* y, int n,
+                                   const FitBounds& bounds = FitBounds()) {
+    auto start = std::chrono::steady_clock::now();
+    SeparableFit fit(t, y, n, bounds);
+    FitResult result;
+    result.iterations = 0;
+    double amp, phase;
+    auto cost = [&](double f) {
+        ++result.iterations;
+        return fit.solve(f, amp, phase);
+    };
+
+    double coarse = estimate_frequency(y, n, bounds);
+    const double step = 0.05;  // Well under the ~1 cycle spacing of local minima
+    double lo = std::max(bounds.freq_min, coarse - 1), hi = std::min(bounds.freq_max, coarse + 1);
+    double best_f = lo, best_cost = cost(lo);
+    for (double f = lo + step; f <= hi; f += step) {
+        double c = cost(f);
+        if (c < best_cost) {
+            best_cost = c;
+            best_f = f;
+        }
+    }
+
+    const double ratio = (std::sqrt(5.0) - 1) / 2;
+    double a = std::max(bounds.freq_min, best_f - step), b = std::min(bounds.freq_max, best_f + step);
+    double x1 = b - ratio * (b - a), x2 = a + ratio * (b - a);
+    double f1 = cost(x1), f2 = cost(x2);
+    while (b - a > 1e-12) {
+        if (f1 < f2) {
+            b = x2; x2 = x1; f2 = f1;
+            x1 = b - ratio * (b - a);
+            f1 = cost(x1);
+        } else {
+            a = x1; x1 = x2; f1 = f2;
+            x2 = a + ratio * (b - a);
+            f2 = cost(x2);
+        }
+    }
+    double f = std::min(f1, f2) < best_cost ? (f1 < f2 ? x1 : x2) : best_f;
+    double rss = cost(f);
+
+    result.amp = amp;
+    result.freq = f;
+    result.phase = phase;
+    result.error = std::sqrt(rss / n);
+    result.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+struct LevenbergMarquardtOptions {
+    int starts = 16;            // frequency starting points across the bounds
+    int max_iterations = 100;   // per start
+    double gradient_tol = 1e-12;
+    double step_tol = 1e-12;
+};
+
+// Solves the 3x3 system m * x = v by Cramer's rule. Returns false if m is
+// numerically singular.
+inline bool solve3(const double m[3][3], const double v[3], double x[3]) {
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (!(std::fabs(det) > 1e-300)) return false;
+    for (int k = 0; k < 3; ++k) {
+        double a[3][3];
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j) a[i][j] = j == k ? v[i] : m[i][j];
+        x[k] = (a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+              - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+              + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0])) / det;
+    }
+    return true;
+}
+
+// Levenberg-Marquardt on r_i = amp*sin(freq*t_i + phase) - y_i from a single
+// start. The Jacobian row is [sin, amp*t*cos, amp*cos]. Steps are projected
+// back into the bounds and the phase is kept in [0, 2pi).
+inline FitResult refine_levenberg_marquardt(const double* t, const double* y, int n,
+                                            double amp, double freq, double phase,
+                                            const FitBounds& bounds,
+                                            const LevenbergMarquardtOptions& options) {
+    std::vector<double> s(n), c(n);
+    auto evaluate = [&](double a, double f, double p) {
+        sine_wave(s.data(), t, n, 1.0, f, p);
+        sine_wave(c.data(), t, n, 1.0, f, p + M_PI / 2);
+        double cost = 0;
+        for (int i = 0; i < n; ++i) {
+            double r = a * s[i] - y[i];
+            cost += r * r;
+        }
+        return cost;
+    };
+
+    double cost = evaluate(amp, freq, phase);
+    double lambda = 1e-3;
+    int iteration = 0;
+    while (iteration < options.max_iterations) {
+        ++iteration;
+        double jtj[3][3] = {{0}}, jtr[3] = {0};
+        for (int i = 0; i < n; ++i) {
+            double r = amp * s[i] - y[i];
+            double row[3] = {s[i], amp * t[i] * c[i], amp * c[i]};
+            for (int a = 0; a < 3; ++a) {
+                jtr[a] += row[a] * r;
+                for (int b = 0; b < 3; ++b) jtj[a][b] += row[a] * row[b];
+            }
+        }
+        if (std::max({std::fabs(jtr[0]), std::fabs(jtr[1]), std::fabs(jtr[2])}) < options.gradient_tol) break;
+
+        bool improved = false;
+        double step_norm = 0;
+        while (lambda < 1e12) {
+            double m[3][3], neg[3] = {-jtr[0], -jtr[1], -jtr[2]}, d[3];
+            for (int a = 0; a < 3; ++a)
+                for (int b = 0; b < 3; ++b) m[a][b] = jtj[a][b] + (a == b ? lambda * jtj[a][a] : 0);
+            if (!solve3(m, neg, d)) {
+                lambda *= 10;
+                continue;
+            }
+            double next_amp = std::min(std::max(amp + d[0], bounds.amp_min), bounds.amp_max);
+            double next_freq = std::min(std::max(freq + d[1], bounds.freq_min), bounds.freq_max);
+            double next_phase = std::fmod(phase + d[2], 2 * M_PI);
+            if (next_phase < 0) next_phase += 2 * M_PI;
+            double next_cost = evaluate(next_amp, next_freq, next_phase);
+            if (next_cost < cost) {
+                step_norm = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                amp = next_amp;
+                freq = next_freq;
+                phase = next_phase;
+                cost = next_cost;
+                lambda = std::max(lambda / 10, 1e-12);
+                improved = true;
+                break;
+            }
+            lambda *= 10;
+        }
+        if (!improved) {
+            evaluate(amp, freq, phase);  // Restore s/c for the accepted point
+            break;
+        }
+        double scale = std::sqrt(amp * amp + freq * freq + phase * phase);
+        if (step_norm < options.step_tol * (scale + options.step_tol)) break;
+    }
+
+    FitResult result;
+    result.amp = amp;
+    result.freq = freq;
+    result.phase = phase;
+    result.error = std::sqrt(cost / n);
+    result.iterations = iteration;
+    result.micros = 0;
+    return result;
+}
+
+// Multi-start LM: starts are spread evenly over the frequency bounds (the
+// cost is multimodal in frequency), each seeded with the closed-form
+// amp/phase for its frequency and refined independently. With a pool the
+// starts run in parallel. iterations is the total over all starts.
+inline FitResult fit_levenberg_marquardt(const double* t, const double* y, int n,
+                                         WorkStealingPool* pool,
+                                         const FitBounds& bounds = FitBounds(),
+                                         const LevenbergMarquardtOptions& options = LevenbergMarquardtOptions()) {
+    auto start = std::chrono::steady_clock::now();
+    int starts = std::max(1, options.starts);
+    std::vector<FitResult> results(starts);
+    auto run_start = [&](unsigned, size_t k) {
+        double f = starts == 1 ? (bounds.freq_min + bounds.freq_max) / 2
+                 : bounds.freq_min + (bounds.freq_max - bounds.freq_min) * k / (starts - 1);
+        SeparableFit seed(t, y, n, bounds);
+        double amp, phase;
+        seed.solve(f, amp, phase);
+        results[k] = refine_levenberg_marquardt(t, y, n, amp, f, phase, bounds, options);
+    };
+    if (pool) pool->run(starts, run_start);
+    else for (int k = 0; k < starts; ++k) run_start(0, k);
+
+    FitResult best = results[0];
+    int total = 0;
+    for (const FitResult& r : results) {
+        total += r.iterations;
+        if (r.error < best.error) best = r;
+    }
+    best.iterations = total;
+    best.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return best;
+}
+
+// N samples per wave, fixed at compile time, or N == 0 for a size chosen at
+// construction (see c.cpp).
+template <int N = 256>
 class WaveGrub {
 private:
-    std::vector<double> t;
-    std::vector<double> wave;
-    std::vector<double> target_wave;
+    int n;
+    AlignedBuffer t;
+    AlignedBuffer wave;
+    AlignedBuffer target_wave;
     double amp, freq, phase;
     double target_amp, target_freq, target_phase;
-    static const int SIZE = 256;
+    SolverMode solver;
+    unsigned solver_threads;
+    int lm_starts;
+    // True while the buffer holds exactly the sinusoid its parameters
+    // describe, which lets calculate_error() skip the samples.
+    bool wave_pure, target_pure;
+    std::ostream* log;  // solver chatter; null keeps a solve quiet
+    double telemetry_rate;     // sweep progress lines per second on log
+    std::FILE* telemetry_log;  // binary log of every sweep record, or null
+
+    // The amp/freq/phase values auto_solve() visits, in sweep order. They
+    // are accumulated exactly like the serial loops so every solver sees the
+    // same bit patterns.
+    struct SolveGrid {
+        std::vector<double> amps, freqs, phases;
+    };
+
+    static const SolveGrid& solve_grid() {
+        static const SolveGrid grid = [] {
+            const double amp_min = 0.1, amp_max = 2.0, amp_step = 0.01;
+            const double freq_min = 0.1, freq_max = 2.0, freq_step = 0.01;
+            const double phase_min = 0, phase_max = 2 * M_PI, phase_step = 0.01;
+            SolveGrid g;
+            for (double v = amp_min; v <= amp_max; v += amp_step) g.amps.push_back(v);
+            for (double v = freq_min; v <= freq_max; v += freq_step) g.freqs.push_back(v);
+            for (double v = phase_min; v <= phase_max; v += phase_step) g.phases.push_back(v);
+            return g;
+        }();
+        return grid;
+    }
+
+public:
+    explicit WaveGrub(int samples = N) :
+        n(N ? N : samples), t(n), wave(n), target_wave(n),
+        amp(1), freq(1), phase(0),
+        solver(SolverMode::Parallel), solver_threads(0), lm_starts(16),
+        wave_pure(false), target_pure(false), log(&std::cout), telemetry_rate(10), telemetry_log(nullptr) {
+        for (int i = 0; i < size(); ++i) {
+            t[i] = 2 * M_PI * i / size();
+        }
+        generate_target_wave();
+        update_wave();
+    }
+
+    int size() const { return N ? N : n; }
 
     template<typename T>
     std::string to_hex(T value) {
@@ -25,19 +493,11 @@ private:
         return stream.str();
     }
 
-public:
-    WaveGrub() : 
-        t(SIZE), wave(SIZE), target_wave(SIZE),
-        amp(1), freq(1), phase(0) {
-        for (int i = 0; i < SIZE; ++i) {
-            t[i] = 2 * M_PI * i / SIZE;
-        }
-        generate_target_wave();
-        update_wave();
+    void generate_target_wave() {
+        generate_target_wave(std::chrono::system_clock::now().time_since_epoch().count());
     }
 
-    void generate_target_wave() {
-        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+    void generate_target_wave(unsigned seed) {
         std::default_random_engine generator(seed);
         std::uniform_real_distribution<double> dist(0.5, 1.5);
         
@@ -45,15 +505,25 @@ public:
         target_freq = dist(generator);
         target_phase = dist(generator) * M_PI;
 
-        for (int i = 0; i < SIZE; ++i) {
-            target_wave[i] = target_amp * std::sin(target_freq * t[i] + target_phase);
-        }
+        sine_wave(target_wave.data(), t.data(), size(), target_amp, target_freq, target_phase);
+        target_pure = true;
+    }
+
+    // Makes y (size() samples, from a wave file say) the target. params is
+    // the file's stored answer if it has one; without it the solution
+    // memory reads NaN.
+    void load_target_wave(const double* y, const WaveFileParams* params) {
+        std::copy(y, y + size(), target_wave.data());
+        const double unknown = std::numeric_limits<double>::quiet_NaN();
+        target_amp = params ? params->amp : unknown;
+        target_freq = params ? params->freq : unknown;
+        target_phase = params ? params->phase : unknown;
+        target_pure = false;
     }
 
     void update_wave() {
-        for (int i = 0; i < SIZE; ++i) {
-            wave[i] = amp * std::sin(freq * t[i] + phase);
-        }
+        sine_wave(wave.data(), t.data(), size(), amp, freq, phase);
+        wave_pure = true;
     }
 
     void interpret(const std::string& code) {
@@ -80,12 +550,27 @@ public:
         phase = 0;
     }
 
+    void set_solver(SolverMode mode, unsigned threads, int starts) {
+        solver = mode;
+        solver_threads = threads;
+        lm_starts = starts;
+    }
+
     double calculate_error() {
-        double error = 0;
-        for (int i = 0; i < SIZE; ++i) {
-            error += std::pow(wave[i] - target_wave[i], 2);
+        if (wave_pure && target_pure) {
+            return analytic_rms_error(size(), amp, freq, phase, target_amp, target_freq, target_phase);
         }
-        return std::sqrt(error / SIZE);
+        return sampled_error();
+    }
+
+    double sampled_error() {
+        return rms_error(wave.data(), target_wave.data(), size());
+    }
+
+    // Hash of both waves and their parameters, which a replayed game checks
+    uint64_t checksum() const {
+        const double params[6] = {amp, freq, phase, target_amp, target_freq, target_phase};
+        return state_hash(target_wave.data(), size(), state_hash(wave.data(), size(), state_hash(params, 6)));
     }
 
     void print_waves() {
@@ -93,11 +578,12 @@ public:
         std::cout << "Amp = " << amp << " (" << to_hex(amp) << ")" << std::endl;
         std::cout << "Freq = " << freq << " (" << to_hex(freq) << ")" << std::endl;
         std::cout << "Phase = " << phase << " (" << to_hex(phase) << ")" << std::endl;
+        const int stride = std::max(1, size() / 8);
         std::cout << "Wave:        ";
-        for (int i = 0; i < SIZE; i += SIZE/8) 
+        for (int i = 0; i < size(); i += stride) 
             std::cout << std::fixed << std::setprecision(2) << wave[i] << " ";
         std::cout << "\nTarget Wave: ";
-        for (int i = 0; i < SIZE; i += SIZE/8) 
+        for (int i = 0; i < size(); i += stride) 
             std::cout << std::fixed << std::setprecision(2) << target_wave[i] << " ";
         std::cout << "\nCurrent error: " << calculate_error() << std::endl;
     }
@@ -112,13 +598,82 @@ public:
                   << ", Value = " << target_phase << " (" << to_hex(target_phase) << ")" << std::endl;
     }
 
+    void set_log(std::ostream* os) {
+        log = os;
+    }
+
+    void set_telemetry(double rate, std::FILE* binary_log) {
+        telemetry_rate = rate;
+        telemetry_log = binary_log;
+    }
+
     void auto_solve() {
+        finish_solve(solve());
+    }
+
+    // Runs the selected solver without touching this wave's parameters.
+    // With progress set it reports as it goes and stops early on cancel.
+    FitResult solve(SolveProgress* progress = nullptr) {
+        if (solver == SolverMode::Parallel) return solve_parallel(progress);
+        if (solver == SolverMode::LeastSquares) return solve_least_squares(progress);
+        if (solver == SolverMode::LevenbergMarquardt) return solve_levenberg_marquardt(progress);
+        return solve_serial(progress);
+    }
+
+    FitResult solve_levenberg_marquardt(SolveProgress* progress) {
+        WorkStealingPool pool(solver_threads);
+        LevenbergMarquardtOptions options;
+        options.starts = lm_starts;
+        FitResult fit = fit_levenberg_marquardt(t.data(), target_wave.data(), size(), &pool,
+                                                FitBounds(), options);
+        if (log) {
+            *log << "\nLevenberg-Marquardt fit: " << options.starts << " starts, "
+                 << fit.iterations << " iterations in " << fit.micros << " us" << std::endl;
+        }
+        if (progress) progress->offer(fit.error, fit.amp, fit.freq, fit.phase);
+        return fit;
+    }
+
+    FitResult solve_least_squares(SolveProgress* progress) {
+        FitResult fit = fit_least_squares(t.data(), target_wave.data(), size());
+        if (log) {
+            *log << "\nLeast-squares fit: " << fit.iterations << " evaluations in "
+                 << fit.micros << " us" << std::endl;
+        }
+        if (progress) progress->offer(fit.error, fit.amp, fit.freq, fit.phase);
+        return fit;
+    }
+
+    FitResult solve_serial(SolveProgress* progress) {
         const double amp_min = 0.1, amp_max = 2.0, amp_step = 0.01;
         const double freq_min = 0.1, freq_max = 2.0, freq_step = 0.01;
         const double phase_min = 0, phase_max = 2 * M_PI, phase_step = 0.01;
+        auto start = std::chrono::steady_clock::now();
+        const double start_amp = amp, start_freq = freq, start_phase = phase;
 
         double best_amp = amp, best_freq = freq, best_phase = phase;
-        double best_error = calculate_error();
+        double best_error = sampled_error();
+        if (progress) {
+            const SolveGrid& grid = solve_grid();
+            progress->total = grid.amps.size() * grid.freqs.size() * grid.phases.size();
+            progress->offer(best_error, best_amp, best_freq, best_phase);
+        }
+
+        // Every 10th candidate goes to telemetry; the drain thread decides
+        // what reaches the terminal
+        std::unique_ptr<Telemetry<SweepRecord>> telemetry;
+        if ((log && telemetry_rate > 0) || telemetry_log) {
+            auto format = [this](std::ostream& os, const SweepRecord& r) {
+                os << "\nIteration " << r.iteration << ":\n"
+                   << "Checking: Amp = " << to_hex(r.amp) << ", Freq = " << to_hex(r.freq)
+                   << ", Phase = " << to_hex(r.phase) << "\n"
+                   << "Best match: Amp = " << to_hex(r.best_amp) << ", Freq = " << to_hex(r.best_freq)
+                   << ", Phase = " << to_hex(r.best_phase) << "\n"
+                   << "Current error: " << r.error << ", Best error: " << r.best_error << "\n";
+            };
+            telemetry.reset(new Telemetry<SweepRecord>(telemetry_rate > 0 ? log : nullptr, format,
+                                                       telemetry_rate, telemetry_log));
+        }
 
         int iteration = 0;
         for (double test_amp = amp_min; test_amp <= amp_max; test_amp += amp_step) {
@@ -128,50 +683,285 @@ public:
                     freq = test_freq;
                     phase = test_phase;
                     update_wave();
-                    double current_error = calculate_error();
+                    double current_error = sampled_error();
                     
                     if (current_error < best_error) {
                         best_error = current_error;
                         best_amp = amp;
                         best_freq = freq;
                         best_phase = phase;
+                        if (progress) progress->offer(best_error, best_amp, best_freq, best_phase);
                     }
 
                     iteration++;
-                    if (iteration % 10 == 0) {
-                        std::cout << "\nIteration " << iteration << ":" << std::endl;
-                        std::cout << "Checking: Amp = " << to_hex(amp) 
-                                  << ", Freq = " << to_hex(freq)
-                                  << ", Phase = " << to_hex(phase) << std::endl;
-                        std::cout << "Best match: Amp = " << to_hex(best_amp)
-                                  << ", Freq = " << to_hex(best_freq)
-                                  << ", Phase = " << to_hex(best_phase) << std::endl;
-                        std::cout << "Current error: " << current_error 
-                                  << ", Best error: " << best_error << std::endl;
+                    if (telemetry && iteration % 10 == 0) {
+                        telemetry->push({(uint64_t)iteration, amp, freq, phase, current_error,
+                                         best_amp, best_freq, best_phase, best_error});
+                    }
+                    if (progress) {
+                        progress->evaluated.store(iteration, std::memory_order_relaxed);
+                        if (progress->cancelled()) break;
                     }
 
                     if (best_error < 0.0001) {  // Early exit if we find a very close match
                         break;
                     }
                 }
-                if (best_error < 0.0001) break;
+                if (best_error < 0.0001 || (progress && progress->cancelled())) break;
+            }
+            if (best_error < 0.0001 || (progress && progress->cancelled())) break;
+        }
+        if (telemetry) {
+            telemetry->stop();
+            if (log && telemetry->dropped_records() > 0) {
+                *log << "Telemetry: " << telemetry->dropped_records() << " of " << telemetry->records()
+                     << " progress records dropped" << std::endl;
+            }
+        }
+
+        // The sweep is a search, not a change of parameters
+        amp = start_amp;
+        freq = start_freq;
+        phase = start_phase;
+        update_wave();
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return {best_amp, best_freq, best_phase, best_error, iteration, micros};
+    }
+
+    // Same sweep as solve_serial(), split across a work-stealing pool.
+    // A task is one freq and a block of AMP_BLOCK amps: the sine basis for
+    // each phase is computed once and score_amplitudes() rates the whole
+    // block against it, bit-identical to update_wave() + calculate_error().
+    // Each worker keeps its own best; candidates are ranked by (error, sweep
+    // index) so the merge reproduces the serial loop's first-strictly-better
+    // choice. The early exit is an atomic minimum over the sweep indices
+    // that beat the threshold: tasks that start past it are skipped, tasks
+    // before it always finish, and the serial loop would have stopped
+    // exactly there.
+    FitResult solve_parallel(SolveProgress* progress) {
+        const SolveGrid& grid = solve_grid();
+        const double exit_error = 0.0001;
+        const size_t AMP_BLOCK = 32;
+        auto start = std::chrono::steady_clock::now();
+        double start_error = sampled_error();
+        if (start_error < exit_error) {
+            // The serial loop stops after one candidate; nothing to split
+            return solve_serial(progress);
+        }
+
+        struct Best {
+            double error = std::numeric_limits<double>::infinity();
+            size_t index = std::numeric_limits<size_t>::max();
+            char pad[64 - sizeof(double) - sizeof(size_t)];  // One cache line each
+        };
+        struct Scratch {
+            AlignedBuffer basis, errors;
+            Scratch(int samples, size_t block) : basis(samples), errors(block) {}
+        };
+
+        const size_t n_amp = grid.amps.size(), n_freq = grid.freqs.size(), n_phase = grid.phases.size();
+        const size_t amp_blocks = (n_amp + AMP_BLOCK - 1) / AMP_BLOCK;
+        const size_t tasks = amp_blocks * n_freq;
+        WorkStealingPool pool(solver_threads);
+        std::vector<Best> bests(pool.size());
+        std::vector<Scratch> scratch(pool.size(), Scratch(size(), AMP_BLOCK));
+        std::atomic<size_t> exit_index(std::numeric_limits<size_t>::max());
+        std::atomic<size_t> tasks_done(0), scored(0);
+        if (progress) {
+            progress->total = n_amp * n_freq * n_phase;
+            progress->offer(start_error, amp, freq, phase);
+        }
+
+        pool.run(tasks, [&](unsigned worker, size_t task) {
+            size_t a0 = task / n_freq * AMP_BLOCK, fi = task % n_freq;
+            size_t count = std::min(AMP_BLOCK, n_amp - a0);
+            if ((a0 * n_freq + fi) * n_phase > exit_index.load(std::memory_order_relaxed)) return;
+            if (progress && progress->cancelled()) return;
+            double* basis = scratch[worker].basis.data();
+            double* errors = scratch[worker].errors.data();
+            Best& best = bests[worker];
+            for (size_t k = 0; k < n_phase; ++k) {
+                sine_wave(basis, t.data(), size(), 1.0, grid.freqs[fi], grid.phases[k]);
+                score_amplitudes(basis, target_wave.data(), size(), &grid.amps[a0], (int)count, errors);
+                for (size_t j = 0; j < count; ++j) {
+                    size_t index = ((a0 + j) * n_freq + fi) * n_phase + k;
+                    double current_error = errors[j];
+                    if (current_error < best.error || (current_error == best.error && index < best.index)) {
+                        best.error = current_error;
+                        best.index = index;
+                    }
+                    if (current_error < exit_error) {
+                        size_t seen = exit_index.load(std::memory_order_relaxed);
+                        while (index < seen &&
+                               !exit_index.compare_exchange_weak(seen, index, std::memory_order_relaxed)) {
+                        }
+                    }
+                }
+            }
+            size_t done = tasks_done.fetch_add(1, std::memory_order_relaxed) + 1;
+            scored.fetch_add(count * n_phase, std::memory_order_relaxed);
+            if (progress) {
+                progress->evaluated.store(scored.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                if (best.index != std::numeric_limits<size_t>::max()) {
+                    size_t row = best.index / n_phase;
+                    progress->offer(best.error, grid.amps[row / n_freq], grid.freqs[row % n_freq],
+                                    grid.phases[best.index % n_phase]);
+                }
+            }
+            if (log && worker == 0 && done % 500 == 0) {
+                *log << "Progress: " << done << "/" << tasks << " tasks" << std::endl;
+            }
+        });
+
+        double best_error = start_error;
+        size_t best_index = std::numeric_limits<size_t>::max();
+        size_t stop = exit_index.load();
+        if (stop != std::numeric_limits<size_t>::max()) {
+            best_index = stop;
+        } else {
+            // Ties between workers go to the earlier candidate, as in the
+            // serial sweep; the start point stays unless a candidate beats it
+            double grid_error = std::numeric_limits<double>::infinity();
+            size_t grid_index = std::numeric_limits<size_t>::max();
+            for (const Best& b : bests) {
+                if (b.error < grid_error || (b.error == grid_error && b.index < grid_index)) {
+                    grid_error = b.error;
+                    grid_index = b.index;
+                }
+            }
+            if (grid_error < start_error) {
+                best_error = grid_error;
+                best_index = grid_index;
             }
-            if (best_error < 0.0001) break;
         }
 
-        amp = best_amp;
-        freq = best_freq;
-        phase = best_phase;
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (best_index == std::numeric_limits<size_t>::max()) {
+            return {amp, freq, phase, start_error, (int)scored.load(), micros};
+        }
+        size_t row = best_index / n_phase;
+        FitResult fit = {grid.amps[row / n_freq], grid.freqs[row % n_freq], grid.phases[best_index % n_phase],
+                         best_error, (int)scored.load(), micros};
+        if (best_index == stop) {
+            // Only the merge tracks errors; rescore the early-exit candidate
+            double* basis = scratch[0].basis.data();
+            sine_wave(basis, t.data(), size(), fit.amp, fit.freq, fit.phase);
+            fit.error = rms_error(basis, target_wave.data(), size());
+        }
+        return fit;
+    }
+
+    void finish_solve(const FitResult& fit, const char* heading = "Auto-solve complete. Final parameters:") {
+        amp = fit.amp;
+        freq = fit.freq;
+        phase = fit.phase;
         update_wave();
         
-        std::cout << "\nAuto-solve complete. Final parameters:" << std::endl;
+        std::cout << "\n" << heading << std::endl;
         print_waves();
     }
 };
 
-int main() {
-    WaveGrub wg;
+// Compares the analytic error against the sampled one for random pairs of
+// waves in the game's parameter box, including exact and near matches.
+int check_error() {
+    const int n = 256;
+    std::vector<double> t(n), a(n), b(n);
+    for (int i = 0; i < n; ++i) t[i] = 2 * M_PI * i / n;
+    std::default_random_engine generator(12345);
+    std::uniform_real_distribution<double> amp_dist(0.1, 2.0), freq_dist(0.1, 2.0), phase_dist(0, 2 * M_PI);
+    double worst = 0;
+    for (int trial = 0; trial < 100000; ++trial) {
+        double amp = amp_dist(generator), freq = freq_dist(generator), phase = phase_dist(generator);
+        double ta = amp_dist(generator), tf = freq_dist(generator), tp = phase_dist(generator);
+        if (trial % 4 == 1) tf = freq;
+        if (trial % 4 == 2) { ta = amp; tf = freq; tp = phase; }
+        if (trial % 4 == 3) { tf = freq + 1e-7; tp = phase; }
+        sine_wave(a.data(), t.data(), n, amp, freq, phase);
+        sine_wave(b.data(), t.data(), n, ta, tf, tp);
+        double diff = std::fabs(analytic_rms_error(n, amp, freq, phase, ta, tf, tp) - rms_error(a.data(), b.data(), n));
+        worst = std::max(worst, diff);
+    }
+    bool ok = worst < 1e-9;
+    std::cout << "Analytic error: max deviation from sampled " << worst
+              << (ok ? " OK" : " FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// Runs solve() on a copy of the game's wave in a worker thread so the REPL
+// keeps working on the live one. The copy is the snapshot the solver
+// searches from; its result replaces the live parameters when the REPL
+// collects it.
+template <class Grub>
+class BackgroundSolve {
+private:
+    std::unique_ptr<Grub> snapshot;
+    std::unique_ptr<SolveProgress> progress;
+    std::thread worker;
+    FitResult result;
+    std::atomic<bool> finished;
+
+public:
+    BackgroundSolve() : finished(false) {}
+
+    ~BackgroundSolve() {
+        if (running()) {
+            cancel();
+            wait();
+        }
+    }
+
+    bool running() const { return worker.joinable(); }
+    bool done() const { return finished.load(std::memory_order_acquire); }
+
+    void start(const Grub& wg) {
+        snapshot.reset(new Grub(wg));
+        snapshot->set_log(nullptr);
+        progress.reset(new SolveProgress());
+        finished = false;
+        worker = std::thread([this] {
+            result = snapshot->solve(progress.get());
+            finished.store(true, std::memory_order_release);
+        });
+    }
+
+    void cancel() {
+        progress->cancel = true;
+    }
+
+    FitResult wait() {
+        worker.join();
+        return result;
+    }
+
+    void report() const {
+        FitResult best = progress->snapshot();
+        size_t done = progress->evaluated.load(), total = progress->total.load();
+        std::cout << "Solving: " << done << "/" << total << " candidates";
+        if (total > 0) std::cout << " (" << std::fixed << std::setprecision(1) << 100.0 * done / total << "%)";
+        std::cout << std::defaultfloat << std::setprecision(6) << ", best error " << best.error
+                  << " at Amp = " << best.amp << ", Freq = " << best.freq << ", Phase = " << best.phase << std::endl;
+    }
+};
+
+template <class Grub>
+void run_game(Grub& wg, JournalWriter* journal = nullptr) {
     std::string input;
+    BackgroundSolve<Grub> solve;
+    // A background solve lands whenever it finishes, so the journal keeps
+    // its result and how many of the line's commands ran before it; replay
+    // applies it there rather than solving again.
+    auto apply = [&](const FitResult& fit, size_t position, const char* heading) {
+        if (heading) wg.finish_solve(fit, heading);
+        else wg.finish_solve(fit);
+        if (journal) {
+            const double event[4] = {(double)position, fit.amp, fit.freq, fit.phase};
+            journal->record('A', event, sizeof(event));
+        }
+    };
+    auto collect = [&](size_t position) {
+        if (solve.running() && solve.done()) apply(solve.wait(), position, nullptr);
+    };
 
     std::cout << "Welcome to the Wave Matching Game!" << std::endl;
     std::cout << "Try to match the target wave by adjusting the parameters." << std::endl;
@@ -179,7 +969,7 @@ int main() {
     std::cout << "          F/f (increase/decrease frequency)" << std::endl;
     std::cout << "          P/p (increase/decrease phase)" << std::endl;
     std::cout << "          = (print waves), R (reset wave), C (check current error)" << std::endl;
-    std::cout << "          S (auto-solve)" << std::endl;
+    std::cout << "          S (auto-solve in the background), ? (solve progress), X (stop solving)" << std::endl;
     std::cout << "Enter commands (or 'quit' to exit):" << std::endl;
 
     wg.print_waves();
@@ -187,13 +977,38 @@ int main() {
 
     while (true) {
         std::cout << "> ";
-        std::getline(std::cin, input);
-        
-        if (input == "quit") {
+        if (!std::getline(std::cin, input) || input == "quit") {
             break;
         }
+        if (journal) journal->text('L', input);
 
-        wg.interpret(input);
+        collect(0);
+        for (size_t k = 0; k < input.size(); ++k) {
+            char cmd = input[k];
+            if (cmd == 'S') {
+                if (solve.running()) {
+                    std::cout << "Auto-solve is already running" << std::endl;
+                } else {
+                    solve.start(wg);
+                    std::cout << "Auto-solve started; ? shows progress, X stops it" << std::endl;
+                }
+            } else if (cmd == '?') {
+                if (solve.running()) solve.report();
+                else std::cout << "No auto-solve running" << std::endl;
+            } else if (cmd == 'X') {
+                if (solve.running()) {
+                    solve.cancel();
+                    apply(solve.wait(), k + 1, "Auto-solve stopped. Best parameters so far:");
+                }
+            } else {
+                wg.interpret(std::string(1, cmd));
+            }
+        }
+        collect(input.size());
+        if (journal) {
+            journal->u64('H', wg.checksum());
+            journal->flush();
+        }
 
         if (wg.calculate_error() < 0.1) {
             std::cout << "Congratulations! You've matched the wave!" << std::endl;
@@ -202,5 +1017,460 @@ int main() {
     }
 
     std::cout << "Thank you for playing the Wave Matching Game!" << std::endl;
-    return 0;
 }
+
+// Runs a game journal (--record) at full speed with std::cout discarded,
+// checking both waves after every line. S, ? and X don't start or stop
+// anything: the solve results the recording saw are applied where they
+// landed. Reports throughput; any mismatch fails.
+template <class Grub>
+int replay_game(Grub& wg, JournalReader& journal, const std::string& path) {
+    ReplayStats stats;
+    {
+        SilencedStream quiet(std::cout);
+        std::string line;
+        bool pending = false;
+        std::vector<std::pair<size_t, FitResult>> solves;
+        auto run_line = [&] {
+            if (!pending) return;
+            size_t next = 0;
+            for (size_t k = 0;; ++k) {
+                for (; next < solves.size() && solves[next].first <= k; ++next) wg.finish_solve(solves[next].second);
+                if (k == line.size()) break;
+                char cmd = line[k];
+                if (cmd != 'S' && cmd != '?' && cmd != 'X') wg.interpret(std::string(1, cmd));
+            }
+            solves.clear();
+            pending = false;
+            ++stats.lines;
+        };
+        JournalRecord r;
+        auto start = std::chrono::steady_clock::now();
+        while (journal.next(r)) {
+            switch (r.kind) {
+                case 'S': wg.generate_target_wave((unsigned)r.u64()); break;
+                case 'L':
+                    run_line();
+                    line.assign(r.data, r.size);
+                    pending = true;
+                    break;
+                case 'A': {
+                    double event[4] = {0, 0, 0, 0};
+                    std::memcpy(event, r.data, std::min(r.size, sizeof(event)));
+                    FitResult fit = FitResult();
+                    fit.amp = event[1];
+                    fit.freq = event[2];
+                    fit.phase = event[3];
+                    solves.emplace_back((size_t)event[0], fit);
+                    break;
+                }
+                case 'H':
+                    run_line();
+                    stats.check(r.u64(), wg.checksum());
+                    break;
+            }
+        }
+        run_line();
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return stats.report(std::cout, path, journal.truncated());
+}
+
+// Makes wave `index` of file wg's target
+template <class Grub>
+void load_target(Grub& wg, const WaveFile& file, size_t index) {
+    std::vector<double> scratch(file.samples());
+    wg.load_target_wave(file.wave(index, scratch.data()), file.has_params() ? &file.params(index) : nullptr);
+}
+
+// Target waves for the bulk solver, mapped rather than read: a wave file
+// (wave_file.h, recognized by its magic), a CSV file with one wave per
+// line (blank lines skipped), or raw native doubles, `samples` to a wave.
+// Raw and float64 wave file rows are used in place; CSV lines and float32
+// rows are converted on demand, so workers can share one TargetSet.
+class TargetSet {
+private:
+    MappedFile file;
+    std::unique_ptr<WaveFile> waves;  // set for a wave file
+    bool csv;
+    int n;
+    size_t count;
+    std::vector<size_t> lines;  // CSV: offset of each wave's line
+
+    static size_t line_end(const char* text, size_t size, size_t pos) {
+        const char* end = static_cast<const char*>(std::memchr(text + pos, '\n', size - pos));
+        return end ? end - text : size;
+    }
+
+    static int count_fields(const char* p, const char* end) {
+        int fields = 1;
+        for (; p < end; ++p) fields += *p == ',';
+        return fields;
+    }
+
+public:
+    TargetSet(const std::string& path, int samples) : file(path), csv(false), n(samples), count(0) {
+        if (is_wave_file(file.data(), file.size())) {
+            waves.reset(new WaveFile(std::move(file), path));
+            if (waves->samples() > (size_t)std::numeric_limits<int>::max()) throw std::runtime_error(path + " waves are too long");
+            n = (int)waves->samples();
+            count = waves->size();
+            waves->advise_sequential();
+            return;
+        }
+        csv = path.size() > 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        if (!csv) {
+            if (file.size() % (n * sizeof(double)) != 0) {
+                throw std::runtime_error(path + " is not a whole number of " + std::to_string(n) + "-sample waves");
+            }
+            count = file.size() / (n * sizeof(double));
+            return;
+        }
+        const char* text = file.data();
+        n = 0;
+        for (size_t pos = 0; pos < file.size();) {
+            size_t end = line_end(text, file.size(), pos);
+            if (end > pos && text[pos] != '\r') {
+                int fields = count_fields(text + pos, text + end);
+                if (n == 0) n = fields;
+                if (fields != n) {
+                    throw std::runtime_error("line " + std::to_string(lines.size() + 1) + " has " +
+                                             std::to_string(fields) + " samples, expected " + std::to_string(n));
+                }
+                lines.push_back(pos);
+            }
+            pos = end + 1;
+        }
+        count = lines.size();
+    }
+
+    size_t size() const { return count; }
+    int samples() const { return n; }
+
+    // Wave i, parsed into scratch (n doubles) if it isn't stored as doubles
+    const double* wave(size_t i, double* scratch) const {
+        if (waves) return waves->wave(i, scratch);
+        if (!csv) return reinterpret_cast<const double*>(file.data()) + i * n;
+        const char* p = file.data() + lines[i];
+        const char* end = file.data() + line_end(file.data(), file.size(), lines[i]);
+        for (int k = 0; k < n; ++k) {
+            char* next;
+            // strtod stops at the ',' or the '\n' after the last sample
+            scratch[k] = std::strtod(p, &next);
+            if (next == p || next > end) throw std::runtime_error("bad sample in wave " + std::to_string(i + 1));
+            p = next + 1;
+        }
+        return scratch;
+    }
+};
+
+struct BulkOptions {
+    std::string input, output = "-";
+    unsigned threads = 0;
+    int samples = 256;  // samples per raw wave; CSV and wave files set their own
+    SolverMode solver = SolverMode::LeastSquares;
+};
+
+// Bounds for captured data rather than game targets: any frequency up to
+// Nyquist, and amplitudes up to twice the wave's peak, which leaves room
+// for a window that misses the crests of a slow wave.
+inline FitBounds data_bounds(const double* y, int n) {
+    double peak = 0;
+    for (int i = 0; i < n; ++i) peak = std::max(peak, std::fabs(y[i]));
+    FitBounds bounds;
+    bounds.amp_min = 0;
+    bounds.amp_max = 2 * peak;
+    bounds.freq_min = 0;
+    bounds.freq_max = n / 2.0;
+    return bounds;
+}
+
+// True if a fit stopped against one of the bounds, so the true parameters
+// may lie outside them
+inline bool at_bound(const FitResult& fit, const FitBounds& bounds) {
+    return fit.amp >= bounds.amp_max || fit.freq <= bounds.freq_min || fit.freq >= bounds.freq_max;
+}
+
+// Fits one wave within data_bounds(). Least squares is the fast path; an LM
+// refinement from its answer only runs when the fit leaves a residual, and
+// keeps whichever is better. --solver=lm refines from LSQ unconditionally.
+inline FitResult bulk_fit(const double* t, const double* y, int n, SolverMode solver, const FitBounds& bounds) {
+    FitResult fit = fit_least_squares(t, y, n, bounds);
+    if (solver == SolverMode::LevenbergMarquardt || fit.error > 1e-9) {
+        auto start = std::chrono::steady_clock::now();
+        LevenbergMarquardtOptions options;
+        FitResult refined = refine_levenberg_marquardt(t, y, n, fit.amp, fit.freq, fit.phase, bounds, options);
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        refined.iterations += fit.iterations;
+        refined.micros = fit.micros + micros;
+        if (refined.error < fit.error) return refined;
+        fit.iterations = refined.iterations;
+        fit.micros = refined.micros;
+    }
+    return fit;
+}
+
+// Fits every wave of options.input on a thread pool and writes one CSV row
+// per wave, in input order, to options.output. Throughput goes to stderr.
+int run_bulk_solve(const BulkOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<TargetSet> targets;
+    try {
+        targets.reset(new TargetSet(options.input, options.samples));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::ofstream file;
+    if (options.output != "-") {
+        file.open(options.output);
+        if (!file) {
+            std::cerr << "Cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.output == "-" ? std::cout : file;
+
+    const int n = targets->samples();
+    std::vector<double> t(n);
+    for (int i = 0; i < n; ++i) t[i] = 2 * M_PI * i / n;
+
+    WorkStealingPool pool(options.threads);
+    std::vector<std::vector<double>> scratch(pool.size(), std::vector<double>(n));
+    const size_t CHUNK = 4096;  // bounds the rows held in memory
+    std::vector<std::string> rows;
+    std::atomic<size_t> failed(0), at_bounds(0);
+    out << "index,amp,freq,phase,rms_error,iterations,micros,at_bound\n";
+    for (size_t first = 0; first < targets->size(); first += CHUNK) {
+        size_t count = std::min(CHUNK, targets->size() - first);
+        rows.assign(count, std::string());
+        pool.run(count, [&](unsigned worker, size_t k) {
+            char row[256];
+            try {
+                const double* y = targets->wave(first + k, scratch[worker].data());
+                FitBounds bounds = data_bounds(y, n);
+                FitResult fit = bulk_fit(t.data(), y, n, options.solver, bounds);
+                bool bounded = at_bound(fit, bounds);
+                if (bounded) at_bounds.fetch_add(1, std::memory_order_relaxed);
+                std::snprintf(row, sizeof(row), "%zu,%.17g,%.17g,%.17g,%.17g,%d,%.3f,%d\n", first + k, fit.amp,
+                              fit.freq, fit.phase, fit.error, fit.iterations, fit.micros, bounded ? 1 : 0);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                std::snprintf(row, sizeof(row), "%zu,nan,nan,nan,nan,0,0,0\n", first + k);
+                failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            rows[k] = row;
+        });
+        for (const std::string& row : rows) out.write(row.data(), row.size());
+    }
+    out.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Solved " << targets->size() << " waves of " << n << " samples in " << seconds << " s ("
+              << targets->size() / seconds << " waves/sec, " << pool.size() << " threads)";
+    if (at_bounds) std::cerr << ", " << at_bounds << " at a bound";
+    if (failed) std::cerr << ", " << failed << " unreadable";
+    std::cerr << std::endl;
+    return out ? 0 : 1;
+}
+
+// Parses the whole number after an option's '=' into value, which must lie
+// in [min, max]. Prints why and returns false otherwise.
+bool parse_option(const std::string& arg, size_t prefix, long long min, long long max, long long& value) {
+    const char* text = arg.c_str() + prefix;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0) {
+        std::cerr << "Not a number: " << arg << std::endl;
+        return false;
+    }
+    if (value < min || value > max) {
+        std::cerr << arg.substr(0, prefix - 1) << " must be in " << min << ".." << max << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The same for a real number, which must be finite and in [min, max]
+bool parse_option(const std::string& arg, size_t prefix, double min, double max, double& value) {
+    const char* text = arg.c_str() + prefix;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtod(text, &end);
+    if (end == text || *end != '\0' || errno != 0 || !std::isfinite(value)) {
+        std::cerr << "Not a number: " << arg << std::endl;
+        return false;
+    }
+    if (value < min || value > max) {
+        std::streamsize precision = std::cerr.precision(10);
+        std::cerr << arg.substr(0, prefix - 1) << " must be in " << min << ".." << max << std::endl;
+        std::cerr.precision(precision);
+        return false;
+    }
+    return true;
+}
+
+#ifndef WAVEGRUB_NO_MAIN
+int main(int argc, char* argv[]) {
+    SolverMode solver = SolverMode::Parallel;
+    unsigned threads = 0;
+    int starts = 16;
+    int samples = 256;
+    double telemetry_rate = 10;
+    std::FILE* telemetry_log = nullptr;
+    BulkOptions bulk;
+    bool solver_given = false;
+    bool size_given = false;
+    std::string target_path, record_path, replay_path;
+    size_t target_index = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--solver=") == 0) solver_given = true;
+        if (arg == "--solver=serial") solver = SolverMode::Serial;
+        else if (arg == "--solver=parallel") solver = SolverMode::Parallel;
+        else if (arg == "--solver=lsq") solver = SolverMode::LeastSquares;
+        else if (arg == "--solver=lm") solver = SolverMode::LevenbergMarquardt;
+        else if (arg.compare(0, 13, "--solve-file=") == 0) bulk.input = arg.substr(13);
+        else if (arg.compare(0, 9, "--output=") == 0) bulk.output = arg.substr(9);
+        else if (arg.compare(0, 9, "--starts=") == 0) {
+            long long value;
+            if (!parse_option(arg, 9, 1, std::numeric_limits<int>::max(), value)) return 1;
+            starts = (int)value;
+        }
+        else if (arg == "--check-error") return check_error();
+        else if (arg.compare(0, 10, "--threads=") == 0) {
+            long long value;
+            if (!parse_option(arg, 10, 1, 4096, value)) return 1;
+            threads = (unsigned)value;
+        }
+        else if (arg.compare(0, 7, "--size=") == 0) {
+            long long value;
+            if (!parse_option(arg, 7, 1, std::numeric_limits<int>::max(), value)) return 1;
+            samples = (int)value;
+            size_given = true;
+        }
+        else if (arg.compare(0, 9, "--target=") == 0) target_path = arg.substr(9);
+        else if (arg.compare(0, 15, "--target-index=") == 0) {
+            long long value;
+            if (!parse_option(arg, 15, 0, std::numeric_limits<long long>::max(), value)) return 1;
+            target_index = (size_t)value;
+        }
+        else if (arg.compare(0, 9, "--record=") == 0) record_path = arg.substr(9);
+        else if (arg.compare(0, 9, "--replay=") == 0) replay_path = arg.substr(9);
+        else if (arg.compare(0, 17, "--telemetry-rate=") == 0) {
+            // 0 keeps sweep progress off the terminal; --telemetry-log still records it
+            if (!parse_option(arg, 17, 0.0, 1e6, telemetry_rate)) return 1;
+        }
+        else if (arg.compare(0, 16, "--telemetry-log=") == 0) {
+            telemetry_log = std::fopen(arg.c_str() + 16, "wb");
+            if (!telemetry_log) {
+                std::cerr << "Cannot open " << arg.substr(16) << std::endl;
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!bulk.input.empty()) {
+        if (solver_given && solver != SolverMode::LeastSquares && solver != SolverMode::LevenbergMarquardt) {
+            std::cerr << "--solve-file runs lsq or lm" << std::endl;
+            return 1;
+        }
+        bulk.threads = threads;
+        bulk.samples = samples;
+        if (solver_given) bulk.solver = solver;
+        return run_bulk_solve(bulk);
+    }
+
+    // A replay takes the recorded size. A game played against --target
+    // needs the same --target again; the checksums catch a different one.
+    std::unique_ptr<JournalReader> replay;
+    if (!replay_path.empty()) {
+        if (!record_path.empty()) {
+            std::cerr << "--replay and --record don't mix" << std::endl;
+            return 1;
+        }
+        try {
+            replay.reset(new JournalReader(replay_path, "for_uci"));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        JournalRecord r;
+        while (replay->next(r) && r.kind == 'O') {
+            std::string option = r.text();
+            if (option.compare(0, 5, "size=") != 0) continue;
+            int recorded = std::atoi(option.c_str() + 5);
+            if (size_given && recorded != samples) {
+                std::cerr << replay_path << " was recorded with --size=" << recorded << std::endl;
+                return 1;
+            }
+            samples = recorded;
+            size_given = true;
+        }
+        replay->rewind();
+    }
+
+    std::unique_ptr<WaveFile> target;
+    if (!target_path.empty()) {
+        try {
+            target.reset(new WaveFile(target_path));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (target_index >= target->size()) {
+            std::cerr << target_path << " has " << target->size() << " waves, no wave " << target_index << std::endl;
+            return 1;
+        }
+        if (target->samples() > (size_t)std::numeric_limits<int>::max() ||
+            (size_given && target->samples() != (size_t)samples)) {
+            std::cerr << target_path << " holds " << target->samples() << "-sample waves, not " << samples << std::endl;
+            return 1;
+        }
+        samples = (int)target->samples();
+    }
+
+    // The target's seed is recorded so replay starts from the same target
+    std::unique_ptr<JournalWriter> journal;
+    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+    if (!record_path.empty()) {
+        try {
+            journal.reset(new JournalWriter(record_path, "for_uci"));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        journal->text('O', "size=" + std::to_string(samples));
+        if (!target) journal->u64('S', seed);
+    }
+
+    int status = 0;
+    if (samples == 256) {
+        WaveGrub<256> wg;
+        wg.set_solver(solver, threads, starts);
+        wg.set_telemetry(telemetry_rate, telemetry_log);
+        if (journal && !target) wg.generate_target_wave(seed);
+        if (target) load_target(wg, *target, target_index);
+        if (replay) status = replay_game(wg, *replay, replay_path);
+        else run_game(wg, journal.get());
+    } else {
+        WaveGrub<0> wg(samples);
+        wg.set_solver(solver, threads, starts);
+        wg.set_telemetry(telemetry_rate, telemetry_log);
+        if (journal && !target) wg.generate_target_wave(seed);
+        if (target) load_target(wg, *target, target_index);
+        if (replay) status = replay_game(wg, *replay, replay_path);
+        else run_game(wg, journal.get());
+    }
+    if (journal && !journal->ok()) {
+        std::cerr << "Cannot write " << record_path << std::endl;
+        status = 1;
+    }
+    if (telemetry_log) std::fclose(telemetry_log);
+    return status;
+}
+#endif
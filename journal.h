@@ -0,0 +1,215 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ios>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#include "mapped_file.h"
+
+// Session journals: an append-only record of an interactive session with
+// enough in it to run the session again exactly. The file starts with
+// "WGJL" and a u32 version, then holds records of a kind byte, a LEB128
+// payload length and the payload:
+//
+//   'P'  name of the recording program; always the first record
+//   'O'  "key=value" setting the results depend on (the wave size, ...)
+//   'S'  u64 seed the program would otherwise have taken from the clock
+//   'L'  one input line, without its newline
+//   'A'  program-specific event within a line (for_uci: a background
+//        solve's result, with the command it landed at)
+//   'H'  u64 state_hash() of the program's waves after the line
+//
+// Numbers are little-endian. A session that dies mid-write leaves a
+// partial last record, which the reader drops.
+struct JournalRecord {
+    char kind;
+    const char* data;
+    size_t size;
+
+    std::string text() const { return std::string(data, size); }
+
+    uint64_t u64() const {
+        uint64_t v = 0;
+        std::memcpy(&v, data, size < sizeof(v) ? size : sizeof(v));
+        return v;
+    }
+};
+
+class JournalWriter {
+private:
+    std::FILE* file;
+    bool failed;
+
+public:
+    JournalWriter(const std::string& path, const std::string& program) : failed(false) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) throw std::runtime_error("cannot open " + path);
+        const uint32_t version = 1;
+        if (std::fwrite("WGJL", 4, 1, file) != 1 || std::fwrite(&version, sizeof(version), 1, file) != 1) {
+            failed = true;
+        }
+        text('P', program);
+    }
+
+    ~JournalWriter() {
+        if (file) std::fclose(file);
+    }
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    void record(char kind, const void* data, size_t size) {
+        unsigned char head[11];
+        size_t length = 0;
+        head[length++] = (unsigned char)kind;
+        size_t rest = size;
+        do {
+            head[length++] = (unsigned char)((rest & 0x7F) | (rest > 0x7F ? 0x80 : 0));
+            rest >>= 7;
+        } while (rest);
+        if (std::fwrite(head, 1, length, file) != length) failed = true;
+        if (size && std::fwrite(data, 1, size, file) != size) failed = true;
+    }
+
+    void text(char kind, const std::string& s) {
+        record(kind, s.data(), s.size());
+    }
+
+    void u64(char kind, uint64_t v) {
+        record(kind, &v, sizeof(v));
+    }
+
+    // Pushes what is recorded to the file, so a crash loses at most the
+    // line in progress. The REPLs call this once per line.
+    void flush() {
+        if (std::fflush(file) != 0) failed = true;
+    }
+
+    bool ok() const { return !failed; }
+};
+
+// Reads a journal through a read-only mapping, one record at a time.
+class JournalReader {
+private:
+    MappedFile file;
+    size_t start, pos;
+    bool cut;
+
+public:
+    // Throws unless path is a version 1 journal recorded by `program`
+    JournalReader(const std::string& path, const std::string& program) : file(path), start(0), pos(0), cut(false) {
+        uint32_t version = 0;
+        if (file.size() < 8 || std::memcmp(file.data(), "WGJL", 4) != 0) {
+            throw std::runtime_error(path + " is not a session journal");
+        }
+        std::memcpy(&version, file.data() + 4, sizeof(version));
+        if (version != 1) throw std::runtime_error(path + " has journal version " + std::to_string(version));
+        pos = 8;
+        JournalRecord r;
+        if (!next(r) || r.kind != 'P') throw std::runtime_error(path + " has no program record");
+        if (r.text() != program) throw std::runtime_error(path + " was recorded by " + r.text() + ", not " + program);
+        start = pos;
+    }
+
+    // The next record after the program name, or false at the end
+    bool next(JournalRecord& r) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(file.data());
+        const size_t end = file.size();
+        if (pos >= end) return false;
+        size_t at = pos + 1, size = 0;
+        for (int shift = 0;; shift += 7) {
+            if (at >= end || shift > 56) {
+                cut = true;
+                return false;
+            }
+            unsigned char b = p[at++];
+            size |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        if (size > end - at) {
+            cut = true;
+            return false;
+        }
+        r.kind = (char)p[pos];
+        r.data = file.data() + at;
+        r.size = size;
+        pos = at + size;
+        return true;
+    }
+
+    void rewind() { pos = start; }
+
+    // True if reading stopped at a partial record
+    bool truncated() const { return cut; }
+};
+
+// Hash of the exact bit patterns of count doubles, chained through h.
+// -0.0 and 0.0 differ, as do NaN payloads: a replay has to match bit for bit.
+inline uint64_t state_hash(const double* values, size_t count, uint64_t h = 0xCBF29CE484222325ULL) {
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        h = (h ^ bits) * 0x100000001B3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// A streambuf that drops everything, for replaying without terminal I/O
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Points os at a NullBuffer until destroyed
+class SilencedStream {
+private:
+    std::ostream& os;
+    std::streambuf* saved;
+    NullBuffer null;
+
+public:
+    explicit SilencedStream(std::ostream& stream) : os(stream), saved(stream.rdbuf(&null)) {}
+    ~SilencedStream() { os.rdbuf(saved); }
+
+    SilencedStream(const SilencedStream&) = delete;
+    SilencedStream& operator=(const SilencedStream&) = delete;
+};
+
+// Tally of a replay: lines run, checksums compared, and the first line
+// whose checksum differed
+struct ReplayStats {
+    uint64_t lines = 0, checked = 0, mismatches = 0, first_mismatch = 0;
+    double seconds = 0;
+
+    void check(uint64_t recorded, uint64_t actual) {
+        ++checked;
+        if (recorded != actual && mismatches++ == 0) first_mismatch = lines;
+    }
+
+    // Prints the throughput and verdict; returns a process exit status
+    int report(std::ostream& os, const std::string& path, bool truncated) const {
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision(6);
+        os.unsetf(std::ios::floatfield);
+        os << "Replayed " << lines << " lines of " << path << " in " << seconds << " s ("
+           << (seconds > 0 ? lines / seconds : 0.0) << " lines/sec, "
+           << (lines ? seconds * 1e9 / lines : 0.0) << " ns/line); " << checked << " checksums";
+        if (mismatches) os << ", " << mismatches << " mismatched (first after line " << first_mismatch << ")";
+        else os << " match";
+        if (truncated) os << "; the journal ends in a partial record";
+        os << std::endl;
+        os.flags(flags);
+        os.precision(precision);
+        return mismatches ? 1 : 0;
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+// Read-only mmap of a whole file. Pages are faulted in on first touch, so
+// opening is O(1) regardless of the file size. Empty files map to nothing.
+class MappedFile {
+private:
+    void* base;
+    size_t length;
+
+public:
+    MappedFile() : base(nullptr), length(0) {}
+
+    explicit MappedFile(const std::string& path) : base(nullptr), length(0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            base = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                base = nullptr;
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+        }
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile&& other) noexcept : base(other.base), length(other.length) {
+        other.base = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base) ::munmap(base, length);
+    }
+
+    const char* data() const { return static_cast<const char*>(base); }
+
+    // Passes an madvise() access hint (MADV_SEQUENTIAL, ...) for the whole
+    // mapping. Only a hint, so failure is ignored.
+    void advise(int advice) const {
+        if (base) ::madvise(base, length, advice);
+    }
+
+    size_t size() const { return length; }
+};
+
+#endif
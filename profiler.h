@@ -0,0 +1,244 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reads the cycle counter where there is one and a steady_clock in ns
+// elsewhere. Profiler converts either to time from its own calibration.
+#ifndef WAVEGRUB_PROFILE_RDTSC
+#if defined(__x86_64__) || defined(__i386__)
+#define WAVEGRUB_PROFILE_RDTSC 1
+#else
+#define WAVEGRUB_PROFILE_RDTSC 0
+#endif
+#endif
+
+#if WAVEGRUB_PROFILE_RDTSC
+#include <x86intrin.h>
+#endif
+
+inline uint64_t profile_ticks() {
+#if WAVEGRUB_PROFILE_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Call tree of named frames with call counts, ticks and samples touched.
+// A frame is identified by its parent, a static name and a numeric key
+// (a line number, a source span), so entering one is a hash lookup and
+// allocates only the first time that frame is seen. Reports a per-name
+// summary and folded stacks ("a;b;c <self ns>") for flamegraph tools.
+class Profiler {
+private:
+    struct Node {
+        const char* name;
+        uint64_t key;
+        std::string label;
+        uint32_t parent;
+        uint64_t calls = 0, ticks = 0, child_ticks = 0, samples = 0;
+    };
+
+    struct FrameKey {
+        uint32_t parent;
+        const char* name;
+        uint64_t key;
+        bool operator==(const FrameKey& o) const { return parent == o.parent && name == o.name && key == o.key; }
+    };
+
+    struct FrameHash {
+        size_t operator()(const FrameKey& k) const {
+            uint64_t h = (k.key * 0x9E3779B97F4A7C15ULL) ^ (uintptr_t)k.name ^ ((uint64_t)k.parent << 40);
+            return (size_t)(h ^ (h >> 29));
+        }
+    };
+
+    struct Open {
+        uint32_t node;
+        uint64_t start;
+    };
+
+    std::vector<Node> nodes;  // nodes[0] is the root; parents precede children
+    std::unordered_map<FrameKey, uint32_t, FrameHash> index;
+    std::vector<Open> stack;
+    uint64_t start_ticks;
+    std::chrono::steady_clock::time_point start_time;
+
+    uint32_t child(uint32_t parent, const char* name, uint64_t key, const char* text, size_t length) {
+        FrameKey k = {parent, name, key};
+        auto it = index.find(k);
+        if (it != index.end()) return it->second;
+        Node node;
+        node.name = name;
+        node.key = key;
+        node.label = name;
+        if (text) {
+            node.label += ' ';
+            node.label.append(text, length);
+        } else if (key) {
+            node.label += ' ' + std::to_string(key);
+        }
+        std::replace(node.label.begin(), node.label.end(), ';', ':');  // ';' separates folded frames
+        node.parent = parent;
+        nodes.push_back(node);
+        index.emplace(k, (uint32_t)nodes.size() - 1);
+        return (uint32_t)nodes.size() - 1;
+    }
+
+    double ns_per_tick() const {
+#if WAVEGRUB_PROFILE_RDTSC
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+        uint64_t ticks = profile_ticks() - start_ticks;
+        return ticks > 0 ? ns / ticks : 1.0;
+#else
+        return 1.0;
+#endif
+    }
+
+    std::string path(uint32_t i) const {
+        std::string p = nodes[i].label;
+        for (uint32_t j = nodes[i].parent; j != 0; j = nodes[j].parent) p = nodes[j].label + ";" + p;
+        return p;
+    }
+
+public:
+    Profiler() : start_ticks(profile_ticks()), start_time(std::chrono::steady_clock::now()) {
+        Node root;
+        root.name = "all";
+        root.key = 0;
+        root.label = "all";
+        root.parent = 0;
+        nodes.push_back(root);
+        stack.reserve(16);
+        stack.push_back({0, 0});
+    }
+
+    // Opens a frame under the current one. text/length, if given, label it
+    // the first time it is seen (a source span, say).
+    void enter(const char* name, uint64_t key = 0, const char* text = nullptr, size_t length = 0) {
+        uint32_t node = child(stack.back().node, name, key, text, length);
+        stack.push_back({node, profile_ticks()});
+    }
+
+    void exit() {
+        uint64_t elapsed = profile_ticks() - stack.back().start;
+        Node& node = nodes[stack.back().node];
+        ++node.calls;
+        node.ticks += elapsed;
+        stack.pop_back();
+        nodes[stack.back().node].child_ticks += elapsed;
+    }
+
+    // Counts samples read or written by the innermost open frame.
+    void add_samples(uint64_t count) {
+        nodes[stack.back().node].samples += count;
+    }
+
+    // Adds another profiler's tree into this one, frame by frame.
+    void merge(const Profiler& other) {
+        std::vector<uint32_t> map(other.nodes.size(), 0);
+        for (size_t i = 1; i < other.nodes.size(); ++i) {
+            const Node& from = other.nodes[i];
+            uint32_t parent = map[from.parent];
+            FrameKey k = {parent, from.name, from.key};
+            auto it = index.find(k);
+            uint32_t to;
+            if (it != index.end()) {
+                to = it->second;
+            } else {
+                Node node = from;
+                node.parent = parent;
+                node.calls = node.ticks = node.child_ticks = node.samples = 0;
+                nodes.push_back(node);
+                to = (uint32_t)nodes.size() - 1;
+                index.emplace(k, to);
+            }
+            map[i] = to;
+            nodes[to].calls += from.calls;
+            nodes[to].ticks += from.ticks;
+            nodes[to].child_ticks += from.child_ticks;
+            nodes[to].samples += from.samples;
+        }
+    }
+
+    // One row per frame name: calls, inclusive and self time, samples.
+    // Inclusive time counts a name once per call even when it nests.
+    void write_summary(std::ostream& os) const {
+        struct Row {
+            uint64_t calls = 0, ticks = 0, self = 0, samples = 0;
+        };
+        std::map<std::string, Row> rows;
+        uint64_t total = 0;
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            const Node& n = nodes[i];
+            Row& r = rows[n.name];
+            r.calls += n.calls;
+            r.ticks += n.ticks;
+            r.self += n.ticks - n.child_ticks;
+            r.samples += n.samples;
+            total += n.ticks - n.child_ticks;
+        }
+        std::vector<std::pair<std::string, Row>> sorted(rows.begin(), rows.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Row>& a,
+                                                   const std::pair<std::string, Row>& b) {
+            return a.second.self > b.second.self;
+        });
+        const double scale = ns_per_tick();
+        std::ios::fmtflags flags = os.flags();
+        os << std::left << std::setw(20) << "frame" << std::right << std::setw(12) << "calls"
+           << std::setw(14) << "total ms" << std::setw(14) << "self ms" << std::setw(8) << "self%"
+           << std::setw(14) << "samples" << std::setw(12) << "ns/sample" << '\n';
+        for (const auto& row : sorted) {
+            const Row& r = row.second;
+            os << std::left << std::setw(20) << row.first << std::right << std::setw(12) << r.calls
+               << std::fixed << std::setprecision(3) << std::setw(14) << r.ticks * scale * 1e-6
+               << std::setw(14) << r.self * scale * 1e-6 << std::setprecision(1) << std::setw(8)
+               << (total ? 100.0 * r.self / total : 0.0) << std::setw(14) << r.samples << std::setprecision(3)
+               << std::setw(12);
+            if (r.samples) os << r.ticks * scale / r.samples;
+            else os << "-";
+            os << '\n';
+        }
+        os.flags(flags);
+    }
+
+    // The `count` frames named `name` with the most inclusive time.
+    void write_top(std::ostream& os, const char* name, size_t count) const {
+        std::vector<uint32_t> found;
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            if (std::strcmp(nodes[i].name, name) == 0) found.push_back((uint32_t)i);
+        }
+        std::sort(found.begin(), found.end(), [&](uint32_t a, uint32_t b) { return nodes[a].ticks > nodes[b].ticks; });
+        const double scale = ns_per_tick();
+        std::ios::fmtflags flags = os.flags();
+        for (size_t i = 0; i < found.size() && i < count; ++i) {
+            const Node& n = nodes[found[i]];
+            os << std::fixed << std::setprecision(3) << std::setw(12) << n.ticks * scale * 1e-6 << " ms  "
+               << path(found[i]) << '\n';
+        }
+        os.flags(flags);
+    }
+
+    // Folded stacks weighted by self time in ns, as flamegraph.pl and
+    // speedscope read them.
+    void write_folded(std::ostream& os) const {
+        const double scale = ns_per_tick();
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            uint64_t self = (uint64_t)((nodes[i].ticks - nodes[i].child_ticks) * scale);
+            if (self > 0) os << path((uint32_t)i) << ' ' << self << '\n';
+        }
+    }
+};
+
+#endif
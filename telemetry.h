@@ -0,0 +1,147 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+// Bounded single-producer/single-consumer queue. Each side owns one index
+// and only reads the other's, so neither push nor pop locks or allocates.
+template <class T, size_t Capacity>
+class SpscRing {
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    std::atomic<size_t> head;  // next slot to write, owned by the producer
+    char pad[64];              // keep the two indices on separate cache lines
+    std::atomic<size_t> tail;  // next slot to read, owned by the consumer
+    T slots[Capacity];
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    bool try_push(const T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Capacity) return false;
+        slots[h & (Capacity - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        value = slots[t & (Capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Progress reporting kept off a hot loop. The loop pushes fixed-size
+// records into an SpscRing; a drain thread formats at most `rate` of them
+// per second to a text stream (always including the last one) and can
+// append every record to a binary log. A record pushed while the ring is
+// full is dropped and counted, so push() never blocks.
+//
+// The binary log starts with a BinaryLogHeader, then holds the raw
+// records back to back.
+template <class Record>
+class Telemetry {
+public:
+    typedef std::function<void(std::ostream&, const Record&)> Formatter;
+
+    struct BinaryLogHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t record_size;
+    };
+
+private:
+    static const size_t CAPACITY = 4096;
+
+    std::unique_ptr<SpscRing<Record, CAPACITY>> ring;
+    std::ostream* text;
+    Formatter format;
+    std::chrono::nanoseconds interval;
+    std::FILE* binary;
+    std::atomic<bool> stopping;
+    size_t pushed, dropped;  // producer side only
+    size_t shown;            // drain side only
+    std::thread drain_thread;
+
+    void show(const Record& r) {
+        format(*text, r);
+        text->flush();
+        ++shown;
+    }
+
+    void drain() {
+        auto next_show = std::chrono::steady_clock::now();
+        Record latest, r;
+        bool pending = false;
+        while (true) {
+            // Read the flag first: everything pushed before stop() is then
+            // visible to the pops below
+            bool last_pass = stopping.load(std::memory_order_acquire);
+            bool got = false;
+            while (ring->try_pop(r)) {
+                if (binary) std::fwrite(&r, sizeof(Record), 1, binary);
+                latest = r;
+                pending = got = true;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (pending && text && (last_pass || now >= next_show)) {
+                show(latest);
+                pending = false;
+                next_show = now + interval;
+            }
+            if (last_pass) break;
+            if (!got) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (binary) std::fflush(binary);
+    }
+
+public:
+    // text may be null for a binary log only, and binary null for text
+    // only; rate is in records per second.
+    Telemetry(std::ostream* text_out, Formatter formatter, double rate, std::FILE* binary_log) :
+        ring(new SpscRing<Record, CAPACITY>()), text(text_out), format(formatter),
+        interval(std::chrono::nanoseconds((long long)(1e9 / (rate > 0 ? rate : 1)))),
+        binary(binary_log), stopping(false), pushed(0), dropped(0), shown(0) {
+        if (binary && std::ftell(binary) == 0) {
+            BinaryLogHeader header = {{'W', 'G', 'T', 'L'}, 1, (uint32_t)sizeof(Record)};
+            std::fwrite(&header, sizeof(header), 1, binary);
+        }
+        drain_thread = std::thread(&Telemetry::drain, this);
+    }
+
+    ~Telemetry() { stop(); }
+
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    void push(const Record& r) {
+        ++pushed;
+        if (!ring->try_push(r)) ++dropped;
+    }
+
+    // Drains what is queued, shows the last record and joins the thread.
+    // Call from the producer.
+    void stop() {
+        if (!drain_thread.joinable()) return;
+        stopping.store(true, std::memory_order_release);
+        drain_thread.join();
+    }
+
+    size_t records() const { return pushed; }
+    size_t dropped_records() const { return dropped; }
+    size_t shown_records() const { return shown; }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run index-space jobs with work stealing.
+//
+// run(count, body) calls body(worker, task) once for every task in
+// [0, count). Each worker starts with a contiguous slice and takes tasks
+// from its front; a worker that runs dry steals the back half of the
+// largest remaining slice. The calling thread works as worker 0, so a pool
+// of size 1 runs everything inline with no extra threads.
+class WorkStealingPool {
+private:
+    struct Slice {
+        std::mutex lock;
+        size_t begin = 0, end = 0;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Slice>> slices;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    const std::function<void(unsigned, size_t)>* body = nullptr;
+    unsigned generation = 0;
+    unsigned running = 0;
+    bool stopping = false;
+
+    bool pop(unsigned worker, size_t& task) {
+        Slice& own = *slices[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.begin == own.end) return false;
+        task = own.begin++;
+        return true;
+    }
+
+    bool steal(unsigned worker) {
+        unsigned victim = worker;
+        size_t most = 0;
+        for (unsigned i = 0; i < slices.size(); ++i) {
+            if (i == worker) continue;
+            std::lock_guard<std::mutex> guard(slices[i]->lock);
+            size_t left = slices[i]->end - slices[i]->begin;
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim == worker) return false;
+
+        Slice& from = *slices[victim];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(from.lock);
+            size_t left = from.end - from.begin;
+            if (left == 0) return true;  // Raced with the owner; look again
+            end = from.end;
+            begin = end - (left + 1) / 2;
+            from.end = begin;
+        }
+        Slice& own = *slices[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.begin = begin;
+        own.end = end;
+        return true;
+    }
+
+    void work(unsigned worker) {
+        size_t task;
+        while (true) {
+            if (pop(worker, task)) (*body)(worker, task);
+            else if (!steal(worker)) break;
+        }
+    }
+
+    void loop(unsigned worker) {
+        unsigned seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work(worker);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--running == 0) done.notify_all();
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned size = 0) {
+        if (size == 0) size = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < size; ++i) slices.emplace_back(new Slice());
+        for (unsigned i = 1; i < size; ++i) threads.emplace_back(&WorkStealingPool::loop, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& th : threads) th.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const { return (unsigned)slices.size(); }
+
+    void run(size_t count, const std::function<void(unsigned, size_t)>& fn) {
+        unsigned n = size();
+        for (unsigned i = 0; i < n; ++i) {
+            slices[i]->begin = count * i / n;
+            slices[i]->end = count * (i + 1) / n;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            body = &fn;
+            running = n - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return running == 0; });
+        body = nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef WAVE_FILE_H
+#define WAVE_FILE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Binary wave files: a 64-byte header, then `waves` rows of `samples`
+// float32 or float64 samples, each row padded to a multiple of 64 bytes so
+// every wave in a mapping starts on a cache line, then optionally one
+// amp, freq, phase triple of doubles per wave. Little-endian throughout.
+//
+//   offset  field
+//    0      magic "WGWV"
+//    4      u32 version, 1
+//    8      u32 dtype: 1 float32, 2 float64
+//   12      u32 header bytes, where row 0 starts (a multiple of 64)
+//   16      u64 samples per wave
+//   24      u64 waves, or 0 for as many whole rows as the file holds
+//   32      f64 sample rate in Hz, 0 if unknown
+//   40      u64 offset of the params table, 0 if there is none
+//   48      16 bytes reserved, zero
+struct WaveFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t header_bytes;
+    uint64_t samples;
+    uint64_t waves;
+    double sample_rate;
+    uint64_t params_offset;
+    uint64_t reserved[2];
+};
+
+static_assert(sizeof(WaveFileHeader) == 64, "wave file header is 64 bytes");
+
+struct WaveFileParams {
+    double amp, freq, phase;
+};
+
+enum class WaveDType : uint32_t { Float32 = 1, Float64 = 2 };
+
+inline size_t wave_dtype_size(WaveDType d) {
+    return d == WaveDType::Float32 ? sizeof(float) : sizeof(double);
+}
+
+// Bytes between the starts of consecutive rows
+inline size_t wave_file_stride(WaveDType d, uint64_t samples) {
+    return (samples * wave_dtype_size(d) + 63) / 64 * 64;
+}
+
+inline bool is_wave_file(const char* data, size_t size) {
+    return size >= 4 && std::memcmp(data, "WGWV", 4) == 0;
+}
+
+// A wave file mapped read-only. Opening reads and checks the header only;
+// samples are paged in as rows are touched, so a file of any size opens in
+// constant time. float64 rows are used in place.
+class WaveFile {
+private:
+    MappedFile file;
+    WaveFileHeader header;
+    size_t stride;
+    size_t count;
+
+    void open(const std::string& name) {
+        if (file.size() < sizeof(header) || !is_wave_file(file.data(), file.size())) {
+            throw std::runtime_error(name + " is not a wave file");
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (header.version != 1) {
+            throw std::runtime_error(name + " has wave file version " + std::to_string(header.version) +
+                                     ", expected 1");
+        }
+        if (header.dtype != (uint32_t)WaveDType::Float32 && header.dtype != (uint32_t)WaveDType::Float64) {
+            throw std::runtime_error(name + " has unknown sample type " + std::to_string(header.dtype));
+        }
+        if (header.header_bytes < sizeof(header) || header.header_bytes % 64 != 0 ||
+            header.header_bytes > file.size()) {
+            throw std::runtime_error(name + " has a bad header size");
+        }
+        if (header.samples == 0 || header.samples > (1ULL << 40)) {
+            throw std::runtime_error(name + " has a bad sample count");
+        }
+        stride = wave_file_stride(dtype(), header.samples);
+        size_t body = file.size() - header.header_bytes;
+        if (header.waves == 0) {
+            if (header.params_offset != 0) throw std::runtime_error(name + " has params but no wave count");
+            count = body / stride;
+        } else {
+            if (header.waves > body / stride) throw std::runtime_error(name + " is truncated");
+            count = (size_t)header.waves;
+        }
+        if (header.params_offset != 0 &&
+            (header.params_offset % 8 != 0 || header.params_offset > file.size() ||
+             (file.size() - header.params_offset) / sizeof(WaveFileParams) < count)) {
+            throw std::runtime_error(name + " has a truncated params table");
+        }
+    }
+
+public:
+    explicit WaveFile(const std::string& path) : file(path) {
+        open(path);
+    }
+
+    // Takes over a mapping already known to start with the magic
+    WaveFile(MappedFile mapped, const std::string& name) : file(std::move(mapped)) {
+        open(name);
+    }
+
+    size_t size() const { return count; }
+    size_t samples() const { return (size_t)header.samples; }
+    WaveDType dtype() const { return (WaveDType)header.dtype; }
+    double sample_rate() const { return header.sample_rate; }
+    bool has_params() const { return header.params_offset != 0; }
+
+    const WaveFileParams& params(size_t i) const {
+        return reinterpret_cast<const WaveFileParams*>(file.data() + header.params_offset)[i];
+    }
+
+    // Wave i as doubles: in the mapping for float64 files, converted into
+    // scratch (samples() doubles) for float32 ones
+    const double* wave(size_t i, double* scratch) const {
+        const char* row = file.data() + header.header_bytes + i * stride;
+        if (dtype() == WaveDType::Float64) return reinterpret_cast<const double*>(row);
+        const float* f = reinterpret_cast<const float*>(row);
+        for (size_t k = 0; k < samples(); ++k) scratch[k] = f[k];
+        return scratch;
+    }
+
+    // Hints that the rows will be read front to back, once
+    void advise_sequential() const {
+        file.advise(MADV_SEQUENTIAL);
+    }
+};
+
+// Appends waves to a wave file as they are produced, through one buffer
+// of whole rows. The header goes out first with a wave count of 0; close()
+// writes the params table and the count once it knows them. A pipe can't
+// be patched, so waves written to "-" keep the count at 0, which readers
+// take as "every row in the file", and drop their params.
+class WaveFileWriter {
+private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    int fd;
+    bool owns_fd;
+    bool seekable;
+    WaveDType dtype;
+    size_t n, stride;
+    double rate;
+    bool keep_params;
+    std::vector<char> buffer;
+    size_t used;
+    std::vector<WaveFileParams> params;
+    uint64_t waves;
+    bool failed, closed;
+
+    bool write_all(const char* p, size_t size) {
+        while (size > 0) {
+            ssize_t k = ::write(fd, p, size);
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return false;
+            p += k;
+            size -= (size_t)k;
+        }
+        return true;
+    }
+
+    void flush() {
+        if (used > 0 && !failed && !write_all(buffer.data(), used)) failed = true;
+        used = 0;
+    }
+
+    WaveFileHeader make_header() const {
+        WaveFileHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "WGWV", 4);
+        h.version = 1;
+        h.dtype = (uint32_t)dtype;
+        h.header_bytes = sizeof(h);
+        h.samples = n;
+        h.sample_rate = rate;
+        return h;
+    }
+
+public:
+    // path "-" writes to stdout. rate is recorded as is; 0 means unknown.
+    // With with_params set, append()'s params are stored too.
+    WaveFileWriter(const std::string& path, WaveDType type, size_t samples, double sample_rate, bool with_params) :
+        fd(1), owns_fd(false), dtype(type), n(samples), stride(wave_file_stride(type, samples)),
+        rate(sample_rate), keep_params(with_params), used(0), waves(0), failed(false), closed(false) {
+        if (samples == 0) throw std::invalid_argument("wave file needs at least one sample per wave");
+        if (path != "-") {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) throw std::runtime_error("cannot open " + path);
+            owns_fd = true;
+        }
+        seekable = ::lseek(fd, 0, SEEK_CUR) == 0;
+        if (!seekable) keep_params = false;
+        buffer.resize(std::max(BUFFER_BYTES / stride, (size_t)1) * stride);
+        WaveFileHeader h = make_header();
+        std::memcpy(buffer.data(), &h, sizeof(h));
+        used = sizeof(h);
+    }
+
+    ~WaveFileWriter() { close(); }
+
+    WaveFileWriter(const WaveFileWriter&) = delete;
+    WaveFileWriter& operator=(const WaveFileWriter&) = delete;
+
+    // Appends one wave of samples() doubles. Returns false once a write
+    // has failed.
+    bool append(const double* wave, const WaveFileParams& p) {
+        if (used + stride > buffer.size()) flush();
+        char* row = buffer.data() + used;
+        if (dtype == WaveDType::Float64) {
+            std::memcpy(row, wave, n * sizeof(double));
+        } else {
+            float* f = reinterpret_cast<float*>(row);
+            for (size_t k = 0; k < n; ++k) f[k] = (float)wave[k];
+        }
+        size_t data = n * wave_dtype_size(dtype);
+        std::memset(row + data, 0, stride - data);
+        used += stride;
+        if (keep_params) params.push_back(p);
+        ++waves;
+        return !failed;
+    }
+
+    // Writes what is buffered and the params, patches the header where the
+    // output can seek, and closes. Returns false if anything failed.
+    bool close() {
+        if (closed) return !failed;
+        closed = true;
+        flush();
+        if (seekable && !failed) {
+            WaveFileHeader h = make_header();
+            h.waves = waves;
+            if (keep_params && waves > 0) {
+                h.params_offset = sizeof(h) + waves * stride;
+                if (!write_all(reinterpret_cast<const char*>(params.data()), params.size() * sizeof(WaveFileParams))) {
+                    failed = true;
+                }
+            }
+            if (::pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) failed = true;
+        }
+        if (owns_fd && ::close(fd) != 0) failed = true;
+        return !failed;
+    }
+
+    size_t samples() const { return n; }
+    uint64_t size() const { return waves; }
+    bool ok() const { return !failed; }
+};
+
+#endif
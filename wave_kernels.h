@@ -0,0 +1,615 @@
+#ifndef WAVE_KERNELS_H
+#define WAVE_KERNELS_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <algorithm>
+
+// Sine kernel shared by the WaveGrub programs:
+//
+//     out[i] = amp * sin(freq * t[i] + phase)
+//
+// The argument is reduced by pi/2 with a three-part Cody-Waite split and the
+// quadrant picks between fdlibm's sin and cos polynomials on [-pi/4, pi/4].
+// Every ISA level runs the same operations in the same order, so the scalar,
+// SSE2, AVX2 and AVX-512 paths agree with each other bit for bit.
+//
+// Error against std::sin for |x| <= SINE_REDUCTION_LIMIT: at most
+// SINE_MAX_ABS_ERROR absolute for unit amplitude, and at most SINE_MAX_ULP
+// ulp wherever |sin x| >= SINE_ULP_FLOOR. Nearer the zeros of sin the
+// reduction's own error, under 1e-25 in that range, is more than a few ulp
+// of the tiny result, so only the absolute bound holds there. Arguments
+// beyond the limit fall back to std::sin.
+//
+// Build selection:
+//   -DWAVEGRUB_SINE_LIBM          always call std::sin
+//   -DWAVEGRUB_SINE_MAX_ISA=n     cap runtime dispatch (0 scalar, 1 SSE2,
+//                                 2 AVX2, 3 AVX-512)
+
+#ifndef WAVEGRUB_SINE_MAX_ISA
+#define WAVEGRUB_SINE_MAX_ISA 3
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WAVEGRUB_X86_DISPATCH 1
+#else
+#define WAVEGRUB_X86_DISPATCH 0
+#endif
+
+// Owning array of doubles aligned to a cache line, used for every sample
+// buffer so the vector kernels never straddle lines at the start.
+class AlignedBuffer {
+private:
+    double* ptr;
+    size_t count;
+
+    static double* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, 64, std::max<size_t>(n, 1) * sizeof(double)) != 0) throw std::bad_alloc();
+        return static_cast<double*>(p);
+    }
+
+public:
+    AlignedBuffer() : ptr(nullptr), count(0) {}
+
+    explicit AlignedBuffer(size_t n) : ptr(allocate(n)), count(n) {
+        std::fill(ptr, ptr + n, 0.0);
+    }
+
+    AlignedBuffer(const AlignedBuffer& other) : ptr(allocate(other.count)), count(other.count) {
+        std::copy(other.ptr, other.ptr + count, ptr);
+    }
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept : ptr(other.ptr), count(other.count) {
+        other.ptr = nullptr;
+        other.count = 0;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(count, other.count);
+        return *this;
+    }
+
+    ~AlignedBuffer() { std::free(ptr); }
+
+    double* data() { return ptr; }
+    const double* data() const { return ptr; }
+    size_t size() const { return count; }
+    double& operator[](size_t i) { return ptr[i]; }
+    const double& operator[](size_t i) const { return ptr[i]; }
+};
+
+enum class SineIsa { Scalar = 0, SSE2 = 1, AVX2 = 2, AVX512 = 3 };
+
+static const double SINE_REDUCTION_LIMIT = 1e6;
+static const double SINE_MAX_ULP = 4;
+static const double SINE_MAX_ABS_ERROR = 2.3e-16;
+static const double SINE_ULP_FLOOR = 1e-9;
+
+// Keep the compiler from fusing the kernel's multiply/add pairs into FMAs:
+// that would only happen on ISA levels with FMA and break the bit-for-bit
+// agreement between paths. The drivers are noinline so the setting is not
+// lost when they are inlined into a caller built with contraction on.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace sine_detail {
+
+const double TWO_OVER_PI = 6.36619772367581382433e-01;
+const double PIO2_1 = 1.57079632673412561417e+00;   // first 33 bits of pi/2
+const double PIO2_2 = 6.07710050630396597660e-11;   // next 33 bits
+const double PIO2_3 = 2.02226624871116645580e-21;   // next 33 bits
+const double ROUND_SHIFT = 6755399441055744.0;      // 1.5 * 2^52
+
+const double S1 = -1.66666666666666324348e-01;
+const double S2 = 8.33333333332248946124e-03;
+const double S3 = -1.98412698298579493134e-04;
+const double S4 = 2.75573137070700676789e-06;
+const double S5 = -2.50507602534068634195e-08;
+const double S6 = 1.58969099521155010221e-10;
+
+const double C1 = 4.16666666666666019037e-02;
+const double C2 = -1.38888888888741095749e-03;
+const double C3 = 2.48015872894767294178e-05;
+const double C4 = -2.75573143513906633035e-07;
+const double C5 = 2.08757232129817482790e-09;
+const double C6 = -1.13596475577881948265e-11;
+
+// One lane type per ISA; VD is W doubles, VI is W 64-bit integers.
+// The body is written once against GCC/Clang vector extensions and inlined
+// into each target-specific driver below.
+template <class VD, class VI>
+inline __attribute__((always_inline)) void sin_lanes(VD& v) {
+    VD x = v;
+    VD y = x * TWO_OVER_PI + ROUND_SHIFT;
+    VI q = (VI)y;  // low mantissa bits hold round(x * 2/pi)
+    VD k = y - ROUND_SHIFT;
+    VD r = x - k * PIO2_1;
+    r = r - k * PIO2_2;
+    r = r - k * PIO2_3;
+
+    VD z = r * r;
+    VD s = r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+    VD c = (1.0 - 0.5 * z) + z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+
+    VI odd = -(q & 1);
+    VI bits = ((VI)c & odd) | ((VI)s & ~odd);
+    bits ^= (q & 2) << 62;
+    v = (VD)bits;
+}
+
+template <class VD, class VI, int W>
+inline __attribute__((always_inline))
+void sine_wave_lanes(double* out, const double* t, int n, double amp, double freq, double phase) {
+    int i = 0;
+    for (; i + W <= n; i += W) {
+        VD v;
+        std::memcpy(&v, t + i, sizeof(v));
+        v = freq * v + phase;
+        sin_lanes<VD, VI>(v);
+        v = amp * v;
+        std::memcpy(out + i, &v, sizeof(v));
+    }
+    if (i < n) {
+        // Pad the tail into a full lane so every element takes the same path
+        double tail[W] = {0};
+        std::memcpy(tail, t + i, (n - i) * sizeof(double));
+        VD v;
+        std::memcpy(&v, tail, sizeof(v));
+        v = freq * v + phase;
+        sin_lanes<VD, VI>(v);
+        v = amp * v;
+        std::memcpy(tail, &v, sizeof(v));
+        std::memcpy(out + i, tail, (n - i) * sizeof(double));
+    }
+}
+
+typedef double vd1 __attribute__((vector_size(8)));
+typedef long long vi1 __attribute__((vector_size(8)));
+typedef double vd2 __attribute__((vector_size(16)));
+typedef long long vi2 __attribute__((vector_size(16)));
+typedef double vd4 __attribute__((vector_size(32)));
+typedef long long vi4 __attribute__((vector_size(32)));
+typedef double vd8 __attribute__((vector_size(64)));
+typedef long long vi8 __attribute__((vector_size(64)));
+
+__attribute__((noinline))
+inline void sine_wave_scalar(double* out, const double* t, int n, double amp, double freq, double phase) {
+    sine_wave_lanes<vd1, vi1, 1>(out, t, n, amp, freq, phase);
+}
+
+#if WAVEGRUB_X86_DISPATCH
+__attribute__((target("sse2"), noinline))
+inline void sine_wave_sse2(double* out, const double* t, int n, double amp, double freq, double phase) {
+    sine_wave_lanes<vd2, vi2, 2>(out, t, n, amp, freq, phase);
+}
+
+__attribute__((target("avx2"), noinline))
+inline void sine_wave_avx2(double* out, const double* t, int n, double amp, double freq, double phase) {
+    sine_wave_lanes<vd4, vi4, 4>(out, t, n, amp, freq, phase);
+}
+
+__attribute__((target("avx512f"), noinline))
+inline void sine_wave_avx512(double* out, const double* t, int n, double amp, double freq, double phase) {
+    sine_wave_lanes<vd8, vi8, 8>(out, t, n, amp, freq, phase);
+}
+#endif
+
+inline SineIsa detect_isa() {
+    int level = 0;
+#if WAVEGRUB_X86_DISPATCH
+    __builtin_cpu_init();
+    level = 1;
+    if (__builtin_cpu_supports("avx2")) level = 2;
+    if (__builtin_cpu_supports("avx512f")) level = 3;
+#endif
+    if (level > WAVEGRUB_SINE_MAX_ISA) level = WAVEGRUB_SINE_MAX_ISA;
+    return static_cast<SineIsa>(level);
+}
+
+}  // namespace sine_detail
+
+inline SineIsa sine_isa() {
+    static const SineIsa isa = sine_detail::detect_isa();
+    return isa;
+}
+
+inline const char* sine_isa_name(SineIsa isa) {
+    switch (isa) {
+        case SineIsa::SSE2: return "sse2";
+        case SineIsa::AVX2: return "avx2";
+        case SineIsa::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+inline void sine_wave_isa(SineIsa isa, double* out, const double* t, int n,
+                          double amp, double freq, double phase) {
+    using namespace sine_detail;
+#if WAVEGRUB_X86_DISPATCH
+    switch (isa) {
+        case SineIsa::AVX512: sine_wave_avx512(out, t, n, amp, freq, phase); return;
+        case SineIsa::AVX2: sine_wave_avx2(out, t, n, amp, freq, phase); return;
+        case SineIsa::SSE2: sine_wave_sse2(out, t, n, amp, freq, phase); return;
+        default: break;
+    }
+#endif
+    (void)isa;
+    sine_wave_scalar(out, t, n, amp, freq, phase);
+}
+
+// The waves only ever need t in [0, 2pi), so the limit check is done once on
+// the extreme arguments rather than per lane.
+inline void sine_wave(double* out, const double* t, int n, double amp, double freq, double phase) {
+    if (n <= 0) return;
+#ifndef WAVEGRUB_SINE_LIBM
+    double lo = freq * t[0] + phase, hi = freq * t[n - 1] + phase;
+    if (std::fabs(lo) <= SINE_REDUCTION_LIMIT && std::fabs(hi) <= SINE_REDUCTION_LIMIT) {
+        sine_wave_isa(sine_isa(), out, t, n, amp, freq, phase);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; ++i) {
+        out[i] = amp * std::sin(freq * t[i] + phase);
+    }
+}
+
+// Trig-free synthesis for the uniform grid t[i] = 2*pi*i/n. Consecutive
+// samples differ by a fixed rotation e^(i*freq*2*pi/n), so each sample is a
+// complex multiply of an earlier one. Four interleaved chains advance by four
+// steps at a time to break the dependency chain, and every RECURRENCE_ANCHOR
+// samples they are re-seeded from a direct sin/cos, which bounds the drift to
+// RECURRENCE_MAX_ABS_ERROR per unit amplitude regardless of n.
+static const int RECURRENCE_ANCHOR = 64;
+static const double RECURRENCE_MAX_ABS_ERROR = 5e-14;
+
+inline void sine_wave_recurrence(double* out, const double* t, int n,
+                                 double amp, double freq, double phase) {
+    typedef sine_detail::vd4 vd4;
+    double step = freq * (2 * M_PI / n);
+    vd4 lane_c = {1, std::cos(step), std::cos(2 * step), std::cos(3 * step)};
+    vd4 lane_s = {0, std::sin(step), std::sin(2 * step), std::sin(3 * step)};
+    double rot_c = std::cos(4 * step), rot_s = std::sin(4 * step);
+
+    for (int base = 0; base < n; base += RECURRENCE_ANCHOR) {
+        int end = std::min(base + RECURRENCE_ANCHOR, n);
+        double x = freq * t[base] + phase;
+        double c0 = amp * std::cos(x), s0 = amp * std::sin(x);
+        vd4 c = c0 * lane_c - s0 * lane_s;
+        vd4 s = s0 * lane_c + c0 * lane_s;
+        int i = base;
+        for (; i + 4 <= end; i += 4) {
+            std::memcpy(out + i, &s, sizeof(s));
+            vd4 next_c = c * rot_c - s * rot_s;
+            s = s * rot_c + c * rot_s;
+            c = next_c;
+        }
+        for (int j = 0; i < end; ++i, ++j) out[i] = s[j];
+    }
+}
+
+// Selects how update_wave() synthesizes samples.
+enum class WaveEngine { Kernel, Libm, Recurrence };
+
+inline const char* wave_engine_name(WaveEngine engine) {
+    switch (engine) {
+        case WaveEngine::Libm: return "libm";
+        case WaveEngine::Recurrence: return "recurrence";
+        default: return "kernel";
+    }
+}
+
+inline bool parse_wave_engine(const std::string& name, WaveEngine& engine) {
+    if (name == "kernel") engine = WaveEngine::Kernel;
+    else if (name == "libm") engine = WaveEngine::Libm;
+    else if (name == "recurrence") engine = WaveEngine::Recurrence;
+    else return false;
+    return true;
+}
+
+inline void synthesize_wave(WaveEngine engine, double* out, const double* t, int n,
+                            double amp, double freq, double phase) {
+    switch (engine) {
+        case WaveEngine::Libm:
+            for (int i = 0; i < n; ++i) out[i] = amp * std::sin(freq * t[i] + phase);
+            break;
+        case WaveEngine::Recurrence:
+            sine_wave_recurrence(out, t, n, amp, freq, phase);
+            break;
+        default:
+            sine_wave(out, t, n, amp, freq, phase);
+            break;
+    }
+}
+
+// RMS difference of two sample buffers, the metric every solver reports.
+// Kept out of line so callers built with FMA contraction still get exactly
+// the rounding score_amplitudes() reproduces.
+__attribute__((noinline))
+inline double rms_error(const double* a, const double* b, int n) {
+    double error = 0;
+    for (int i = 0; i < n; ++i) {
+        double d = a[i] - b[i];
+        error += d * d;
+    }
+    return std::sqrt(error / n);
+}
+
+// sum_{i=0}^{n-1} cos(w*i + b), summed in closed form with the Dirichlet
+// kernel. Where sin(w/2) vanishes the ratio is replaced by its limit.
+inline double cos_series_sum(int n, double w, double b) {
+    double half = w / 2;
+    double denom = std::sin(half);
+    double ratio = std::fabs(denom) > 1e-12 ? std::sin(n * half) / denom
+                                            : n * std::cos(n * half) / std::cos(half);
+    return ratio * std::cos(b + (n - 1) * half);
+}
+
+// RMS error between amp*sin(freq*t + phase) and the target sinusoid on the
+// grid t[i] = 2*pi*i/n, without touching any samples. Expands the squared
+// difference into sin^2 and sin*sin terms and sums each with
+// cos_series_sum(). When the frequencies match the two waves are combined
+// into one phasor first, which keeps an exact match from cancelling to
+// noise. Agrees with the sampled error to about 1e-11 absolute.
+inline double analytic_rms_error(int n, double amp, double freq, double phase,
+                                 double target_amp, double target_freq, double target_phase) {
+    const double step = 2 * M_PI / n;
+    auto sum_sin_sq = [&](double a, double f, double p) {
+        return a * a * (n - cos_series_sum(n, 2 * f * step, 2 * p)) / 2;
+    };
+    if (freq == target_freq) {
+        double re = amp * std::cos(phase) - target_amp * std::cos(target_phase);
+        double im = amp * std::sin(phase) - target_amp * std::sin(target_phase);
+        double r = std::hypot(re, im);
+        return std::sqrt(sum_sin_sq(r, freq, std::atan2(im, re)) / n);
+    }
+    double cross = (cos_series_sum(n, (freq - target_freq) * step, phase - target_phase)
+                  - cos_series_sum(n, (freq + target_freq) * step, phase + target_phase)) / 2;
+    double sum = sum_sin_sq(amp, freq, phase) + sum_sin_sq(target_amp, target_freq, target_phase)
+               - 2 * amp * target_amp * cross;
+    return std::sqrt(std::max(sum, 0.0) / n);
+}
+
+namespace score_detail {
+
+const int TILE = 512;     // samples of basis + target per pass, 8 KiB
+const int IN_FLIGHT = 4;  // independent accumulators per lane group
+
+// Accumulates sum((amps[k] * basis[i] - target[i])^2) into sums[k] for one
+// tile of samples. Amps run across vector lanes; each lane adds its samples
+// in index order, so every sum rounds exactly like rms_error() on the
+// materialized wave.
+template <class VD, int W>
+inline __attribute__((always_inline))
+void score_tile(const double* basis, const double* target, int begin, int end,
+                const double* amps, int count, double* sums) {
+    const int GROUP = IN_FLIGHT * W;
+    for (int k0 = 0; k0 < count; k0 += GROUP) {
+        int m = std::min(GROUP, count - k0);
+        double a_pad[GROUP] = {0}, e_pad[GROUP] = {0};
+        std::memcpy(a_pad, amps + k0, m * sizeof(double));
+        std::memcpy(e_pad, sums + k0, m * sizeof(double));
+        VD a[IN_FLIGHT], e[IN_FLIGHT];
+        std::memcpy(a, a_pad, sizeof(a));
+        std::memcpy(e, e_pad, sizeof(e));
+        for (int i = begin; i < end; ++i) {
+            double b = basis[i], y = target[i];
+            for (int u = 0; u < IN_FLIGHT; ++u) {
+                VD d = a[u] * b - y;
+                e[u] += d * d;
+            }
+        }
+        std::memcpy(e_pad, e, sizeof(e));
+        std::memcpy(sums + k0, e_pad, m * sizeof(double));
+    }
+}
+
+template <class VD, int W>
+inline __attribute__((always_inline))
+void score_lanes(const double* basis, const double* target, int n,
+                 const double* amps, int count, double* errors) {
+    std::fill(errors, errors + count, 0.0);
+    for (int begin = 0; begin < n; begin += TILE) {
+        score_tile<VD, W>(basis, target, begin, std::min(begin + TILE, n), amps, count, errors);
+    }
+    for (int k = 0; k < count; ++k) errors[k] = std::sqrt(errors[k] / n);
+}
+
+__attribute__((noinline))
+inline void score_scalar(const double* basis, const double* target, int n,
+                         const double* amps, int count, double* errors) {
+    score_lanes<sine_detail::vd1, 1>(basis, target, n, amps, count, errors);
+}
+
+#if WAVEGRUB_X86_DISPATCH
+__attribute__((target("sse2"), noinline))
+inline void score_sse2(const double* basis, const double* target, int n,
+                       const double* amps, int count, double* errors) {
+    score_lanes<sine_detail::vd2, 2>(basis, target, n, amps, count, errors);
+}
+
+__attribute__((target("avx2"), noinline))
+inline void score_avx2(const double* basis, const double* target, int n,
+                       const double* amps, int count, double* errors) {
+    score_lanes<sine_detail::vd4, 4>(basis, target, n, amps, count, errors);
+}
+
+__attribute__((target("avx512f"), noinline))
+inline void score_avx512(const double* basis, const double* target, int n,
+                         const double* amps, int count, double* errors) {
+    score_lanes<sine_detail::vd8, 8>(basis, target, n, amps, count, errors);
+}
+#endif
+
+}  // namespace score_detail
+
+// Scores candidates that share one (freq, phase): basis holds
+// sin(freq * t[i] + phase) as produced by sine_wave(..., 1.0, freq, phase),
+// and errors[k] becomes the RMS error of amps[k] * basis against target.
+// The wave is never materialized, and the result is bit-identical to
+// update_wave() followed by rms_error().
+inline void score_amplitudes(const double* basis, const double* target, int n,
+                             const double* amps, int count, double* errors) {
+    using namespace score_detail;
+#if WAVEGRUB_X86_DISPATCH
+    switch (sine_isa()) {
+        case SineIsa::AVX512: score_avx512(basis, target, n, amps, count, errors); return;
+        case SineIsa::AVX2: score_avx2(basis, target, n, amps, count, errors); return;
+        case SineIsa::SSE2: score_sse2(basis, target, n, amps, count, errors); return;
+        default: break;
+    }
+#endif
+    score_scalar(basis, target, n, amps, count, errors);
+}
+
+// Element-wise wave algebra. A chain of ops runs in one pass: each vector
+// of samples is loaded once, every op in the chain is applied in registers,
+// and the result is stored once. Division guards are masked selects rather
+// than branches; a zero divisor gives 0, as the original loops did.
+enum class WaveOp : unsigned char { Mul, Add, Sub, Div, Inverse };
+
+namespace ops_detail {
+
+template <class VD, class VI, int W>
+inline __attribute__((always_inline))
+void apply_lanes(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    for (int i = 0; i < n; i += W) {
+        int m = std::min(W, n - i);
+        VD w, r;
+        if (m == W) {
+            std::memcpy(&w, wave + i, sizeof(w));
+            std::memcpy(&r, ref + i, sizeof(r));
+        } else {
+            double w_pad[W] = {0}, r_pad[W] = {0};
+            std::memcpy(w_pad, wave + i, m * sizeof(double));
+            std::memcpy(r_pad, ref + i, m * sizeof(double));
+            std::memcpy(&w, w_pad, sizeof(w));
+            std::memcpy(&r, r_pad, sizeof(r));
+        }
+        for (int k = 0; k < count; ++k) {
+            switch (ops[k]) {
+                case WaveOp::Mul: w = w * r; break;
+                case WaveOp::Add: w = w + r; break;
+                case WaveOp::Sub: w = w - r; break;
+                case WaveOp::Div: w = (VD)((VI)(w / r) & (VI)(r != 0)); break;
+                case WaveOp::Inverse: w = (VD)((VI)(1.0 / w) & (VI)(w != 0)); break;
+            }
+        }
+        if (m == W) {
+            std::memcpy(wave + i, &w, sizeof(w));
+        } else {
+            double w_pad[W];
+            std::memcpy(w_pad, &w, sizeof(w));
+            std::memcpy(wave + i, w_pad, m * sizeof(double));
+        }
+    }
+}
+
+__attribute__((noinline))
+inline void apply_scalar(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    apply_lanes<sine_detail::vd1, sine_detail::vi1, 1>(wave, ref, n, ops, count);
+}
+
+#if WAVEGRUB_X86_DISPATCH
+__attribute__((target("sse2"), noinline))
+inline void apply_sse2(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    apply_lanes<sine_detail::vd2, sine_detail::vi2, 2>(wave, ref, n, ops, count);
+}
+
+__attribute__((target("avx2"), noinline))
+inline void apply_avx2(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    apply_lanes<sine_detail::vd4, sine_detail::vi4, 4>(wave, ref, n, ops, count);
+}
+
+__attribute__((target("avx512f"), noinline))
+inline void apply_avx512(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    apply_lanes<sine_detail::vd8, sine_detail::vi8, 8>(wave, ref, n, ops, count);
+}
+#endif
+
+}  // namespace ops_detail
+
+// wave[i] = ops[count-1](... ops[0](wave[i], ref[i]) ...) for every i.
+inline void apply_wave_ops(double* wave, const double* ref, int n, const WaveOp* ops, int count) {
+    using namespace ops_detail;
+    if (count == 0) return;
+#if WAVEGRUB_X86_DISPATCH
+    switch (sine_isa()) {
+        case SineIsa::AVX512: apply_avx512(wave, ref, n, ops, count); return;
+        case SineIsa::AVX2: apply_avx2(wave, ref, n, ops, count); return;
+        case SineIsa::SSE2: apply_sse2(wave, ref, n, ops, count); return;
+        default: break;
+    }
+#endif
+    apply_scalar(wave, ref, n, ops, count);
+}
+
+struct SineErrorReport {
+    double max_ulp;
+    double max_abs;
+    size_t mismatches;  // samples whose bits differ from the scalar path
+};
+
+// Compares one ISA path of the kernel against std::sin, and bit for bit
+// against the scalar path, over a grid of (freq, phase) pairs applied to t.
+// max_ulp only counts results of at least SINE_ULP_FLOOR.
+// isa must not exceed sine_isa(). Used by --check-sine.
+inline SineErrorReport check_sine_kernel(SineIsa isa, const double* t, int n, double freq_max) {
+    SineErrorReport report = {0, 0, 0};
+    double* got = new double[n];
+    double* scalar = new double[n];
+    for (double freq = 0.05; freq <= freq_max; freq += 0.05) {
+        for (double phase = 0; phase < 2 * M_PI; phase += 0.1) {
+            sine_wave_isa(isa, got, t, n, 1.0, freq, phase);
+            sine_wave_isa(SineIsa::Scalar, scalar, t, n, 1.0, freq, phase);
+            for (int i = 0; i < n; ++i) {
+                double want = std::sin(freq * t[i] + phase);
+                double diff = std::fabs(got[i] - want);
+                double ulp = std::fabs(std::nextafter(want, INFINITY) - want);
+                if (diff > report.max_abs) report.max_abs = diff;
+                if (std::fabs(want) >= SINE_ULP_FLOOR && diff / ulp > report.max_ulp) report.max_ulp = diff / ulp;
+                if (std::memcmp(&got[i], &scalar[i], sizeof(double)) != 0) ++report.mismatches;
+            }
+        }
+    }
+    delete[] got;
+    delete[] scalar;
+    return report;
+}
+
+// Largest absolute error of sine_wave_recurrence against std::sin on the
+// uniform grid of n samples, over the same (freq, phase) grid. Used by
+// --check-recurrence.
+inline double check_recurrence_kernel(int n, double freq_max) {
+    double worst = 0;
+    double* t = new double[n];
+    double* got = new double[n];
+    for (int i = 0; i < n; ++i) t[i] = 2 * M_PI * i / n;
+    for (double freq = 0.05; freq <= freq_max; freq += 0.05) {
+        for (double phase = 0; phase < 2 * M_PI; phase += 0.1) {
+            sine_wave_recurrence(got, t, n, 1.0, freq, phase);
+            for (int i = 0; i < n; ++i) {
+                double diff = std::fabs(got[i] - std::sin(freq * t[i] + phase));
+                if (diff > worst) worst = diff;
+            }
+        }
+    }
+    delete[] t;
+    delete[] got;
+    return worst;
+}
+
+#if !defined(__clang__) && defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif